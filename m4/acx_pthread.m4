@@ -174,7 +174,7 @@ if test "x$acx_pthread_ok" = xyes; then
             PTHREAD_CPPFLAGS="$flag $PTHREAD_CPPFLAGS"
         fi
 
-        AC_CHECK_FUNCS([pthread_spin_lock])
+        AC_CHECK_FUNCS([pthread_spin_lock pthread_setaffinity_np])
         LIBS="$save_LIBS"
         CFLAGS="$save_CFLAGS"
 
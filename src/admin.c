@@ -61,6 +61,8 @@ static int command_kill_source(client_t *client, source_t *source, int response)
 static int command_updatemetadata(client_t *client, source_t *source, int response);
 static int command_admin_function (client_t *client, int response);
 static int command_list_log (client_t *client, int response);
+static int command_history (client_t *client, int response);
+static int command_history_mount (client_t *client, source_t *source, int response);
 static int command_manage_relay (client_t *client, int response);
 #ifdef MY_ALLOC
 static int command_alloc(client_t *client);
@@ -88,6 +90,7 @@ static struct admin_command admin_general[] =
     { "manageauth",         RAW,    { command_manageauth } },
     { "listmounts",         RAW,    { command_list_mounts } },
     { "function",           RAW,    { command_admin_function } },
+    { "history",            RAW,    { command_history } },
 #ifdef MY_ALLOC
     { "alloc",              RAW,    { command_alloc } },
 #endif
@@ -116,6 +119,7 @@ static struct admin_command admin_mount[] =
     { "moveclients",        RAW,    { command_move_clients } },
     { "killsource",         RAW,    { command_kill_source } },
     { "stats",              RAW,    { command_stats_mount } },
+    { "history",            RAW,    { command_history_mount } },
     { "manageauth",         RAW,    { command_manageauth } },
     { "admin.cgi",          RAW,    { command_shoutcast_metadata } },
     { "resetstats",         XSLT,   { command_reset_stats } },
@@ -251,6 +255,22 @@ int admin_send_response (xmlDocPtr doc, client_t *client,
 }
 
 
+/* send a ready made body, which is released once sent */
+static int admin_send_content (client_t *client, const char *content_type, refbuf_t *content)
+{
+    unsigned int buf_len = 150;
+
+    client_set_queue (client, NULL);
+    client->refbuf = refbuf_new (buf_len);
+    client->refbuf->len = snprintf (client->refbuf->data, buf_len,
+            "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %u\r\n\r\n",
+            content_type, content->len);
+    client->refbuf->next = content;
+    client->respcode = 200;
+    return fserve_setup_client (client);
+}
+
+
 static struct admin_command *find_admin_command (struct admin_command *list, const char *uri)
 {
     for (; list->request; list++)
@@ -261,7 +281,7 @@ static struct admin_command *find_admin_command (struct admin_command *list, con
     if (list->request == NULL)
     {
         list = NULL;
-        if (strcmp (uri, "stats.xml") != 0)
+        if (strcmp (uri, "stats.xml") != 0 && strcmp (uri, "stats.json") != 0)
             DEBUG1("request (%s) not a builtin", uri);
     }
     return list;
@@ -292,6 +312,8 @@ int admin_mount_request (client_t *client, const char *uri)
         avl_tree_unlock(global.source_tree);
         if (strncmp (cmd->request, "stats", 5) == 0)
             return command_stats (client, uri);
+        if (strcmp (cmd->request, "history") == 0)
+            return command_history (client, cmd->response);
         if (strncmp (cmd->request, "listclients", 11) == 0)
             return fserve_list_clients (client, mount, cmd->response, 1);
         if (strncmp (cmd->request, "killclient", 10) == 0)
@@ -1147,11 +1169,47 @@ static int command_stats (client_t *client, const char *filename)
 
     show_mount = httpp_get_query_param (client->parser, "mount");
 
+    if (filename && strcmp (filename, "stats.json") == 0)
+        return admin_send_content (client, "application/json; charset=utf-8", stats_get_json (show_mount));
+    /* the full stats are the same for everyone so send the shared copy */
+    if (response == RAW && show_mount == NULL)
+        return admin_send_content (client, "text/xml", stats_get_xml_cached ());
     doc = stats_get_xml (STATS_ALL, show_mount);
     return admin_send_response (doc, client, response, filename);
 }
 
 
+static int command_history_mount (client_t *client, source_t *source, int response)
+{
+    thread_rwlock_unlock (&source->lock);
+    return command_history (client, response);
+}
+
+
+/* the recent listener and bitrate figures for a mount, or for the whole
+ * server if no mount is given */
+static int command_history (client_t *client, int response)
+{
+    const char *mount = httpp_get_query_param (client->parser, "mount");
+    const char *value;
+    int interval = 1;
+    time_t since = 0;
+    refbuf_t *content;
+
+    value = httpp_get_query_param (client->parser, "interval");
+    if (value && atoi (value) == 60)
+        interval = 60;
+    value = httpp_get_query_param (client->parser, "since");
+    if (value)
+        since = (time_t)atol (value);
+
+    content = stats_get_history (mount, interval, since);
+    if (content == NULL)
+        return client_send_400 (client, "Source does not exist");
+    return admin_send_content (client, "application/json; charset=utf-8", content);
+}
+
+
 static int command_list_log (client_t *client, int response)
 {
     refbuf_t *content;
@@ -42,6 +42,8 @@
 #define CONFIG_DEFAULT_BURST_SIZE (64*1024)
 #define CONFIG_DEFAULT_CLIENT_TIMEOUT 30
 #define CONFIG_DEFAULT_HEADER_TIMEOUT 15
+#define CONFIG_DEFAULT_KEEPALIVE_TIMEOUT 15
+#define CONFIG_DEFAULT_KEEPALIVE_REQUESTS 100
 #define CONFIG_DEFAULT_SOURCE_TIMEOUT 10
 #define CONFIG_DEFAULT_SOURCE_PASSWORD "changeme"
 #define CONFIG_DEFAULT_RELAY_PASSWORD "changeme"
@@ -49,6 +51,7 @@
 #define CONFIG_DEFAULT_SHOUTCAST_MOUNT "/stream"
 #define CONFIG_DEFAULT_ICE_LOGIN 0
 #define CONFIG_DEFAULT_FILESERVE 1
+#define CONFIG_DEFAULT_FILE_CACHE_SIZE (32*1024*1024)
 #define CONFIG_DEFAULT_TOUCH_FREQ 5
 #define CONFIG_DEFAULT_HOSTNAME "localhost"
 #define CONFIG_DEFAULT_PLAYLIST_LOG NULL
@@ -349,6 +352,7 @@ void config_clear(ice_config_t *c)
     if (c->banfile) xmlFree(c->banfile);
     if (c->allowfile) xmlFree (c->allowfile);
     if (c->agentfile) xmlFree (c->agentfile);
+    if (c->worker_cpus) xmlFree (c->worker_cpus);
     if (c->playlist_log.name) xmlFree(c->playlist_log.name);
     if (c->access_log.name) xmlFree(c->access_log.name);
     if (c->error_log.name) xmlFree(c->error_log.name);
@@ -509,13 +513,17 @@ static void _set_defaults(ice_config_t *configuration)
     configuration->source_limit = CONFIG_DEFAULT_SOURCE_LIMIT;
     configuration->queue_size_limit = CONFIG_DEFAULT_QUEUE_SIZE_LIMIT;
     configuration->workers_count = 1;
+    configuration->acceptors_count = 1;
     configuration->client_timeout = CONFIG_DEFAULT_CLIENT_TIMEOUT;
     configuration->header_timeout = CONFIG_DEFAULT_HEADER_TIMEOUT;
+    configuration->keepalive_timeout = CONFIG_DEFAULT_KEEPALIVE_TIMEOUT;
+    configuration->keepalive_requests = CONFIG_DEFAULT_KEEPALIVE_REQUESTS;
     configuration->source_timeout = CONFIG_DEFAULT_SOURCE_TIMEOUT;
     configuration->source_password = (char *)xmlCharStrdup (CONFIG_DEFAULT_SOURCE_PASSWORD);
     configuration->shoutcast_mount = (char *)xmlCharStrdup (CONFIG_DEFAULT_SHOUTCAST_MOUNT);
     configuration->ice_login = CONFIG_DEFAULT_ICE_LOGIN;
     configuration->fileserve = CONFIG_DEFAULT_FILESERVE;
+    configuration->file_cache_size = CONFIG_DEFAULT_FILE_CACHE_SIZE;
     configuration->touch_interval = CONFIG_DEFAULT_TOUCH_FREQ;
     configuration->on_demand = 0;
     configuration->dir_list = NULL;
@@ -1130,8 +1138,16 @@ static int _parse_limits (xmlNodePtr node, void *arg)
         { "min-queue-size", config_get_int,    &config->min_queue_size },
         { "burst-size",     config_get_int,    &config->burst_size },
         { "workers",        config_get_int,    &config->workers_count },
+        { "worker-epoll",   config_get_bool,   &config->worker_epoll },
+        { "worker-cpus",    config_get_str,    &config->worker_cpus },
+        { "worker-numa-local",  config_get_bool,   &config->worker_numa_local },
+        { "worker-incoming-cpu",config_get_bool,   &config->worker_incoming_cpu },
+        { "acceptors",      config_get_int,    &config->acceptors_count },
+        { "file-cache-size",config_get_int,    &config->file_cache_size },
         { "client-timeout", config_get_int,    &config->client_timeout },
         { "header-timeout", config_get_int,    &config->header_timeout },
+        { "keepalive-timeout",  config_get_int,    &config->keepalive_timeout },
+        { "keepalive-requests", config_get_int,    &config->keepalive_requests },
         { "source-timeout", config_get_int,    &config->source_timeout },
         { "inactivity-timeout", config_get_int,    &config->inactivity_timeout },
         { NULL, NULL, NULL },
@@ -1140,6 +1156,8 @@ static int _parse_limits (xmlNodePtr node, void *arg)
         return -1;
     if (config->workers_count < 1)   config->workers_count = 1;
     if (config->workers_count > 400) config->workers_count = 400;
+    if (config->acceptors_count < 1)  config->acceptors_count = 1;
+    if (config->acceptors_count > 32) config->acceptors_count = 32;
     return 0;
 }
 
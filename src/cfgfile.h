@@ -241,9 +241,17 @@ typedef struct ice_config_tag
     unsigned int queue_size_limit;
     int min_queue_size;
     int workers_count;
+    int worker_epoll;
+    char *worker_cpus;
+    int worker_numa_local;
+    int worker_incoming_cpu;
+    int acceptors_count;
+    unsigned int file_cache_size;
     unsigned int burst_size;
     int client_timeout;
     int header_timeout;
+    int keepalive_timeout;
+    int keepalive_requests;
     int source_timeout;
     int ice_login;
     int64_t max_bandwidth;
@@ -23,6 +23,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <unistd.h>
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 
 #include "thread/thread.h"
 #include "avl/avl.h"
@@ -47,13 +62,20 @@
 #define CATMODULE "client"
 
 int worker_count, worker_min_count;
+int worker_epoll;
+static int worker_incoming_cpu, worker_numa_local, worker_bind_generation;
+static int *worker_cpu_list, worker_cpu_count;
+static unsigned long worker_wakeups_retired, worker_coalesced_retired;
 worker_t *worker_balance_to_check, *worker_least_used;
 
 
 void client_register (client_t *client)
 {
     if (client)
+    {
         global.clients++;
+        stats_counter_inc (STATS_CTR_CLIENTS);
+    }
 }
 
 
@@ -97,7 +119,7 @@ void client_destroy(client_t *client)
 
     global_lock ();
     global.clients--;
-    stats_event_args (NULL, "clients", "%d", global.clients);
+    stats_counter_dec (STATS_CTR_CLIENTS);
     config_clear_listener (client->server_conn);
     global_unlock ();
 
@@ -107,6 +129,7 @@ void client_destroy(client_t *client)
 
     free(client->username);
     free(client->password);
+    refbuf_release (client->pipelined);
 
     free(client);
 }
@@ -240,9 +263,8 @@ int client_send_404 (client_t *client, const char *message)
     client_set_queue (client, NULL);
     if (client->respcode)
     {
-        worker_t *worker = client->worker;
         client->flags = CLIENT_ACTIVE | (client->flags & ~CLIENT_AUTHENTICATED);
-        worker_wakeup (worker);
+        client_wakeup (client);
     }
     else
     {
@@ -329,6 +351,86 @@ void client_set_queue (client_t *client, refbuf_t *refbuf)
 }
 
 
+/* the load of a worker is its client count scaled by how costly its clients
+ * were over the last second compared to the average client, so that the usual
+ * client count thresholds still apply when comparing workers */
+int worker_load (worker_t *worker)
+{
+    int count = worker->count + worker->pending_count;
+
+    if (worker->load_factor <= 0)
+        return count;
+    return (int)(((int64_t)count * worker->load_factor) / 1000);
+}
+
+
+static uint64_t worker_cpu_usec (worker_t *worker)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    clockid_t cid;
+    struct timespec ts;
+
+    if (pthread_getcpuclockid (worker->thread->sys_thread, &cid) == 0 && clock_gettime (cid, &ts) == 0)
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    return 0;
+}
+
+
+/* called once a second with the workers lock held. Work out the bytes sent,
+ * cpu used and clients processed per pass for each worker, and from the share
+ * of those against the share of clients, the relative cost of its clients */
+static void worker_balance_sample (void)
+{
+    static uint64_t sample_ms;
+    uint64_t now = timing_get_time(), interval = now - sample_ms;
+    uint64_t total_bytes = 0, total_cpu = 0, total_due = 0;
+    long total_count = 0;
+    worker_t *worker;
+
+    if (interval < 500)
+        return;
+    sample_ms = now;
+    for (worker = workers; worker; worker = worker->next)
+    {
+        uint64_t bytes = worker->bytes_sent, cpu = worker_cpu_usec (worker);
+        unsigned long passes = worker->passes, due = worker->due_clients;
+
+        worker->bytes_rate = (bytes - worker->last_bytes) * 1000 / interval;
+        worker->cpu_rate = (cpu - worker->last_cpu_usec) * 1000 / interval;
+        worker->due_per_pass = 0;
+        if (passes != worker->last_passes)
+            worker->due_per_pass = (int)((due - worker->last_due_clients) * 100 / (passes - worker->last_passes));
+        worker->last_bytes = bytes;
+        worker->last_cpu_usec = cpu;
+        worker->last_passes = passes;
+        worker->last_due_clients = due;
+
+        total_bytes += worker->bytes_rate;
+        total_cpu += worker->cpu_rate;
+        total_due += worker->due_per_pass;
+        total_count += worker->count;
+    }
+    for (worker = workers; worker; worker = worker->next)
+    {
+        double share = 0.0;
+        int metrics = 0;
+
+        if (total_bytes)    { share += (double)worker->bytes_rate / total_bytes; metrics++; }
+        if (total_cpu)      { share += (double)worker->cpu_rate / total_cpu; metrics++; }
+        if (total_due)      { share += (double)worker->due_per_pass / total_due; metrics++; }
+        worker->load_factor = 1000;
+        if (metrics && worker->count)
+        {
+            double factor = (share / metrics) * total_count * 1000 / worker->count;
+            if (factor < 100)   factor = 100;
+            if (factor > 10000) factor = 10000;
+            worker->load_factor = (int)factor;
+        }
+    }
+}
+
+
 static worker_t *find_least_busy_handler (int log)
 {
     worker_t *min = workers;
@@ -337,12 +439,12 @@ static worker_t *find_least_busy_handler (int log)
     {
         worker_t *handler = workers->next;
 
-        worker_min_count = min->count + min->pending_count;
-        if (log) DEBUG2 ("handler %p has %d clients", min, worker_min_count);
+        worker_min_count = worker_load (min);
+        if (log) DEBUG3 ("handler %p has %d clients, load %d", min, min->count, worker_min_count);
         while (handler)
         {
-            int cur_count = handler->count + handler->pending_count;
-            if (log) DEBUG2 ("handler %p has %d clients", handler, cur_count);
+            int cur_count = worker_load (handler);
+            if (log) DEBUG3 ("handler %p has %d clients, load %d", handler, handler->count, cur_count);
             if (cur_count < worker_min_count)
             {
                 min = handler;
@@ -357,20 +459,33 @@ static worker_t *find_least_busy_handler (int log)
 
 worker_t *worker_selected (void)
 {
-    if ((worker_least_used->count + worker_least_used->pending_count) - worker_min_count > 20)
+    if (worker_load (worker_least_used) - worker_min_count > 20)
         worker_least_used = find_least_busy_handler(1);
     return worker_least_used;
 }
 
 
-/* worker mutex should be already locked */
+static void worker_signal (worker_t *worker);
+
+/* The pending clients of a worker are an intrusive multi-producer, single
+ * consumer list. Producers swap themselves in as the new head and then link to
+ * the previous head, so they never wait on each other. Until that link is made,
+ * next_on_worker holds a marker which the worker waits on when taking the list.
+ */
+#define WORKER_PENDING_LINK     ((client_t *)1)
+
+static void worker_push_pending (worker_t *worker, client_t *first, client_t *last, int count)
+{
+    last->next_on_worker = WORKER_PENDING_LINK;
+    thread_atomic_add (&worker->pending_count, count);
+    last->next_on_worker = thread_atomic_swap (&worker->pending_clients, first);
+}
+
+
 static void worker_add_client (worker_t *worker, client_t *client)
 {
-    ++worker->pending_count;
-    client->next_on_worker = NULL;
-    *worker->pending_clients_tail = client;
-    worker->pending_clients_tail = &client->next_on_worker;
     client->worker = worker;
+    worker_push_pending (worker, client, client, 1);
 }
 
 
@@ -378,17 +493,38 @@ int client_change_worker (client_t *client, worker_t *dest_worker)
 {
     if (dest_worker->running == 0)
         return 0;
-    client->next_on_worker = NULL;
 
-    thread_spin_lock (&dest_worker->lock);
     worker_add_client (dest_worker, client);
-    thread_spin_unlock (&dest_worker->lock);
-    worker_wakeup (dest_worker);
+    worker_signal (dest_worker);
 
     return 1;
 }
 
 
+#ifdef SO_INCOMING_CPU
+/* prefer the worker pinned to the cpu that handled the receive side of the
+ * connection, as long as that worker is not far busier than the least used */
+static worker_t *worker_incoming_handler (client_t *client, worker_t *handler)
+{
+    int cpu = -1;
+    socklen_t len = sizeof (cpu);
+    worker_t *worker;
+
+    if (getsockopt (client->connection.sock, SOL_SOCKET, SO_INCOMING_CPU, (void*)&cpu, &len) < 0 || cpu < 0)
+        return handler;
+    for (worker = workers; worker; worker = worker->next)
+    {
+        if (worker->cpu != cpu)
+            continue;
+        if (worker_load (worker) - worker_min_count > 20)
+            break;
+        return worker;
+    }
+    return handler;
+}
+#endif
+
+
 void client_add_worker (client_t *client)
 {
     worker_t *handler;
@@ -396,12 +532,13 @@ void client_add_worker (client_t *client)
     thread_rwlock_rlock (&workers_lock);
     /* add client to the handler with the least number of clients */
     handler = worker_selected();
-    thread_spin_lock (&handler->lock);
-    thread_rwlock_unlock (&workers_lock);
-
+#ifdef SO_INCOMING_CPU
+    if (worker_incoming_cpu && client->connection.sock != SOCK_ERROR)
+        handler = worker_incoming_handler (client, handler);
+#endif
     worker_add_client (handler, client);
-    thread_spin_unlock (&handler->lock);
-    worker_wakeup (handler);
+    worker_signal (handler);
+    thread_rwlock_unlock (&workers_lock);
 }
 
 
@@ -416,48 +553,483 @@ void client_add_worker (client_t *client)
 #endif
 
 
+/* The clients on a worker are kept in a binary min-heap keyed on when they are
+ * next due, so that each pass only touches those that need processing. The key
+ * is a copy of schedule_ms taken when the client was last looked at, as other
+ * threads may change schedule_ms, so it is validated when the client comes due.
+ */
+#define WORKER_TIMER_IDLE       ((uint64_t)-1)
+
+static void worker_timer_place (worker_t *worker, int idx, struct worker_timer *t)
+{
+    worker->timers [idx] = *t;
+    t->client->timer_idx = idx;
+}
+
+
+static void worker_timer_up (worker_t *worker, int idx)
+{
+    struct worker_timer t = worker->timers [idx];
+
+    while (idx)
+    {
+        int parent = (idx-1) / 2;
+        if (worker->timers [parent].due <= t.due)
+            break;
+        worker_timer_place (worker, idx, &worker->timers [parent]);
+        idx = parent;
+    }
+    worker_timer_place (worker, idx, &t);
+}
+
+
+static void worker_timer_down (worker_t *worker, int idx)
+{
+    struct worker_timer t = worker->timers [idx];
+    int used = worker->timers_used;
+
+    while (1)
+    {
+        int child = (idx * 2) + 1;
+        if (child >= used)
+            break;
+        if (child+1 < used && worker->timers [child+1].due < worker->timers [child].due)
+            child++;
+        if (t.due <= worker->timers [child].due)
+            break;
+        worker_timer_place (worker, idx, &worker->timers [child]);
+        idx = child;
+    }
+    worker_timer_place (worker, idx, &t);
+}
+
+
+static void worker_timer_add (worker_t *worker, client_t *client, uint64_t due)
+{
+    if (worker->timers_used == worker->timers_alloc)
+    {
+        int len = worker->timers_alloc + 256;
+        struct worker_timer *arr = realloc (worker->timers, len * sizeof (struct worker_timer));
+        if (arr == NULL)
+            abort();
+        worker->timers = arr;
+        worker->timers_alloc = len;
+    }
+    worker->timers [worker->timers_used].due = due;
+    worker->timers [worker->timers_used].client = client;
+    client->timer_idx = worker->timers_used++;
+    worker_timer_up (worker, client->timer_idx);
+}
+
+
+static client_t *worker_timer_pop (worker_t *worker)
+{
+    client_t *client = worker->timers[0].client;
+
+    worker->timers_used--;
+    if (worker->timers_used)
+    {
+        worker_timer_place (worker, 0, &worker->timers [worker->timers_used]);
+        worker_timer_down (worker, 0);
+    }
+    client->timer_idx = -1;
+    return client;
+}
+
+
+/* change when a client on this worker is due */
+static void worker_timer_set (worker_t *worker, client_t *client, uint64_t due)
+{
+    int idx = client->timer_idx;
+    uint64_t prev;
+
+    if (idx < 0 || idx >= worker->timers_used || worker->timers [idx].client != client)
+        return;
+    prev = worker->timers [idx].due;
+    worker->timers [idx].due = due;
+    if (due < prev)
+        worker_timer_up (worker, idx);
+    else
+        worker_timer_down (worker, idx);
+}
+
+
+/* the schedule of many clients has changed, such as when they are taken off
+ * epoll, so pull forward those keys and rebuild the heap. When the worker is
+ * stopping, everything is made due.
+ */
+static void worker_timer_recheck (worker_t *worker)
+{
+    int i;
+
+    worker->recheck = 0;
+    for (i = 0; i < worker->timers_used; i++)
+    {
+        struct worker_timer *t = &worker->timers [i];
+        if (worker->running == 0)
+            t->due = 0;
+        else if (t->client->schedule_ms < t->due)
+            t->due = t->client->schedule_ms;
+    }
+    for (i = worker->timers_used/2 - 1; i >= 0; i--)
+        worker_timer_down (worker, i);
+}
+
+
+/* make due the clients listed by other threads, each is moved up the heap on
+ * its own */
+static void worker_take_woken (worker_t *worker)
+{
+    int i;
+
+    if (worker->woken_count == 0)
+        return;
+    thread_spin_lock (&worker->woken_lock);
+    for (i = 0; i < worker->woken_count; i++)
+    {
+        client_t *client = worker->woken [i];
+
+        client->schedule_ms = 0;
+        worker_timer_set (worker, client, 0);
+    }
+    worker->woken_count = 0;
+    thread_spin_unlock (&worker->woken_lock);
+}
+
+
+/* a client leaving the worker cannot be left on the woken list */
+static void worker_drop_woken (worker_t *worker, client_t *client)
+{
+    int i = 0;
+
+    thread_spin_lock (&worker->woken_lock);
+    while (i < worker->woken_count)
+    {
+        if (worker->woken [i] == client)
+            worker->woken [i] = worker->woken [--worker->woken_count];
+        else
+            i++;
+    }
+    thread_spin_unlock (&worker->woken_lock);
+}
+
+
+#ifdef HAVE_SYS_EPOLL_H
+#define WORKER_EPOLL_EVENTS     64
+/* longest time a client is left waiting for the socket to drain before it gets
+ * processed anyway, so that timeouts and lag checks still apply */
+#define WORKER_EPOLL_PARK_MS    1000
+
+static void worker_epoll_control (worker_t *worker)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl (worker->epoll_fd, EPOLL_CTL_ADD, worker->wakeup_fd[0], &ev) < 0)
+        ERROR1 ("unable to add worker control to epoll, %s", strerror (errno));
+}
+
+
+/* client could not write all it wanted, or is idle waiting for a further
+ * request, so have the socket report when it is ready instead of retrying on
+ * a timer. The schedule is pushed out so that the timer only acts as a fallback,
+ * for an idle connection that is when it is due to be dropped.
+ */
+static void worker_epoll_park (worker_t *worker, client_t *client)
+{
+    connection_t *con = &client->connection;
+    struct epoll_event ev;
+    int read_idle = con->read_idle;
+
+    con->write_blocked = 0;
+    con->read_idle = 0;
+    if (con->sock == SOCK_ERROR || con->error)
+        return;
+    ev.events = (read_idle ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT;
+    ev.data.ptr = client;
+    if (epoll_ctl (worker->epoll_fd, EPOLL_CTL_ADD, con->sock, &ev) < 0)
+    {
+        /* still registered from a previous trigger */
+        if (errno != EEXIST || epoll_ctl (worker->epoll_fd, EPOLL_CTL_MOD, con->sock, &ev) < 0)
+            return;
+    }
+    con->polled = 1;
+    if (read_idle && con->discon_time > worker->current_time.tv_sec)
+        client->schedule_ms = worker->time_ms + (con->discon_time - worker->current_time.tv_sec) * 1000;
+    else if (client->schedule_ms < worker->time_ms + WORKER_EPOLL_PARK_MS)
+        client->schedule_ms = worker->time_ms + WORKER_EPOLL_PARK_MS;
+}
+
+
+/* drop the registration as the client may be moved or released once processed */
+static void worker_epoll_unpark (worker_t *worker, client_t *client)
+{
+    struct epoll_event ev;
+
+    client->connection.polled = 0;
+    epoll_ctl (worker->epoll_fd, EPOLL_CTL_DEL, client->connection.sock, &ev);
+}
+
+
+static void worker_epoll_release (worker_t *worker)
+{
+    int i;
+
+    if (worker->epoll_fd < 0)
+        return;
+    for (i = 0; i < worker->timers_used; i++)
+    {
+        client_t *client = worker->timers[i].client;
+        if (client->connection.polled)
+        {
+            worker_epoll_unpark (worker, client);
+            client->schedule_ms = 0;
+        }
+    }
+    close (worker->epoll_fd);
+    worker->epoll_fd = -1;
+    worker->recheck = 1;
+    DEBUG1 ("epoll disabled on worker %p", worker);
+}
+
+
+/* enable or disable epoll on this worker depending on the current setting */
+static void worker_epoll_check (worker_t *worker)
+{
+    if (worker_epoll == 0 || worker->running == 0)
+    {
+        worker_epoll_release (worker);
+        return;
+    }
+    if (worker->epoll_fd >= 0)
+        return;
+    worker->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (worker->epoll_fd < 0)
+    {
+        WARN1 ("epoll unavailable for worker, %s", strerror (errno));
+        worker_epoll = 0;
+        return;
+    }
+    worker_epoll_control (worker);
+    DEBUG1 ("epoll enabled on worker %p", worker);
+}
+
+
+/* returns > 0 if the control pipe needs draining. Clients whose sockets are
+ * now writable are made due for processing */
+static int worker_epoll_wait (worker_t *worker, int duration)
+{
+    struct epoll_event events [WORKER_EPOLL_EVENTS];
+    int i, ret, control = 0;
+
+    ret = epoll_wait (worker->epoll_fd, events, WORKER_EPOLL_EVENTS, duration);
+    for (i = 0; i < ret; i++)
+    {
+        client_t *client = events[i].data.ptr;
+
+        if (client == NULL)
+        {
+            control = 1;
+            continue;
+        }
+        if (client->connection.polled == 0)
+            continue;
+        client->connection.polled = 0;
+        client->schedule_ms = 0;
+        worker_timer_set (worker, client, 0);
+    }
+    return control;
+}
+#endif
+
+
+/* the worker is woken up via an eventfd if available, both ends are then the
+ * same descriptor, else a pipe is used */
 static void worker_control_create (worker_t *worker)
 {
-    if (pipe_create (&worker->wakeup_fd[0]) < 0)
+#ifdef HAVE_SYS_EVENTFD_H
+    worker->wakeup_fd[0] = worker->wakeup_fd[1] = eventfd (0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (worker->wakeup_fd[0] < 0)
+#endif
     {
-        ERROR0 ("pipe failed, descriptor limit?");
-        abort();
+        if (pipe_create (&worker->wakeup_fd[0]) < 0)
+        {
+            ERROR0 ("pipe failed, descriptor limit?");
+            abort();
+        }
+        sock_set_blocking (worker->wakeup_fd[0], 0);
     }
-    sock_set_blocking (worker->wakeup_fd[0], 0);
+#ifdef HAVE_SYS_EPOLL_H
+    if (worker->epoll_fd >= 0)
+        worker_epoll_control (worker);
+#endif
 }
 
 
-static client_t **worker_add_pending_clients (worker_t *worker)
+static void worker_control_close (worker_t *worker)
+{
+    if (worker->wakeup_fd[1] != worker->wakeup_fd[0])
+        sock_close (worker->wakeup_fd[1]);
+    sock_close (worker->wakeup_fd[0]);
+}
+
+
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP) && defined(CPU_SET)
+static cpu_set_t worker_cpus_default;
+static int worker_cpus_default_set;
+#endif
+
+/* called on the worker thread itself, as the memory policy applies to the
+ * calling thread only. With a local policy, memory first touched by the worker
+ * (eg the per-thread malloc arena) comes from the node of the cpu it is on */
+static void worker_bind_cpu (worker_t *worker)
+{
+    worker->bind_generation = worker_bind_generation;
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP) && defined(CPU_SET)
+    if (worker->cpu >= 0)
+    {
+        cpu_set_t set;
+
+        CPU_ZERO (&set);
+        CPU_SET (worker->cpu, &set);
+        if (pthread_setaffinity_np (pthread_self(), sizeof (set), &set) == 0)
+            INFO2 ("worker %p pinned to cpu %d", worker, worker->cpu);
+        else
+            WARN2 ("worker %p failed to pin to cpu %d", worker, worker->cpu);
+    }
+    else if (worker_cpus_default_set)
+        pthread_setaffinity_np (pthread_self(), sizeof (worker_cpus_default), &worker_cpus_default);
+#endif
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    {
+        /* MPOL_PREFERRED with an empty node mask is local allocation, MPOL_DEFAULT
+         * reverts to the process policy */
+        int numa_local = (worker_numa_local && worker->cpu >= 0) ? 1 : 0;
+
+        if (numa_local != worker->numa_local)
+        {
+            if (syscall (SYS_set_mempolicy, numa_local, NULL, 0) == 0)
+                worker->numa_local = numa_local;
+            else
+                WARN1 ("unable to set memory policy for worker %p", worker);
+        }
+    }
+#endif
+}
+
+
+static int worker_cpus_parse (const char *str, int **list)
+{
+    int count = 0, *cpus = NULL;
+
+    while (str && *str)
+    {
+        char *end;
+        long first = strtol (str, &end, 10), last = first;
+
+        if (end == str || first < 0)
+            break;
+        if (*end == '-')
+        {
+            str = end+1;
+            last = strtol (str, &end, 10);
+            if (end == str || last < first)
+                break;
+        }
+        if (last - first > 4095)
+            last = first + 4095;
+        cpus = realloc (cpus, (count + (last-first) + 1) * sizeof (int));
+        while (first <= last)
+            cpus [count++] = (int)first++;
+        str = end + strspn (end, ", ");
+    }
+    *list = cpus;
+    return count;
+}
+
+
+/* pick up the worker related settings, workers started later take the next
+ * cpu in the list, existing workers rebind themselves when next awake */
+void workers_config (ice_config_t *config)
+{
+    int *cpus = NULL, count = 0, i;
+    worker_t *worker;
+
+    worker_epoll = config->worker_epoll;
+    worker_incoming_cpu = config->worker_incoming_cpu;
+    if (config->worker_cpus)
+        count = worker_cpus_parse (config->worker_cpus, &cpus);
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP) && defined(CPU_SET)
+    if (worker_cpus_default_set == 0)
+    {
+        pthread_getaffinity_np (pthread_self(), sizeof (worker_cpus_default), &worker_cpus_default);
+        worker_cpus_default_set = 1;
+    }
+#else
+    if (count)
+        WARN0 ("worker-cpus specified but pinning threads is not supported, ignoring");
+    count = 0;
+#endif
+    thread_rwlock_wlock (&workers_lock);
+    free (worker_cpu_list);
+    worker_cpu_list = cpus;
+    worker_cpu_count = count;
+    worker_numa_local = config->worker_numa_local;
+    worker_bind_generation++;
+    i = worker_count;
+    for (worker = workers; worker; worker = worker->next)
+    {
+        i--;
+        worker->cpu = count ? cpus [i % count] : -1;
+        worker_signal (worker);
+    }
+    thread_rwlock_unlock (&workers_lock);
+}
+
+
+static void worker_add_pending_clients (worker_t *worker)
 {
     if (worker->pending_clients)
     {
-        unsigned count;
-        client_t **p;
-
-        thread_spin_lock (&worker->lock);
-        p = worker->last_p;
-        *worker->last_p = worker->pending_clients;
-        worker->last_p = worker->pending_clients_tail;
-        worker->count += worker->pending_count;
-        count = worker->pending_count;
-        worker->pending_clients = NULL;
-        worker->pending_clients_tail = &worker->pending_clients;
-        worker->pending_count = 0;
-        thread_spin_unlock (&worker->lock);
+        int count = 0;
+        client_t *client, *list = NULL;
+
+        client = thread_atomic_swap (&worker->pending_clients, NULL);
+        /* newest are first, so reverse to process in arrival order */
+        while (client)
+        {
+            client_t *next;
+
+            while ((next = *(client_t * volatile *)&client->next_on_worker) == WORKER_PENDING_LINK)
+                thread_barrier();
+            client->next_on_worker = list;
+            list = client;
+            client = next;
+            count++;
+        }
+        thread_atomic_sub (&worker->pending_count, count);
+        worker->count += count;
+        while (list)
+        {
+            client = list;
+            list = client->next_on_worker;
+            client->next_on_worker = NULL;
+            worker_timer_add (worker, client, client->schedule_ms);
+        }
         DEBUG2 ("Added %d pending clients to %p", count, worker);
-        if (worker->wakeup_ms > worker->time_ms+5)
-            return p;  /* only these new ones scheduled so process from here */
     }
-    worker->wakeup_ms = worker->time_ms + 60000;
-    return &worker->clients;
 }
 
 
-static client_t **worker_wait (worker_t *worker)
+static void worker_wait (worker_t *worker)
 {
     int ret, duration = 0;
 
-    if (global.running == ICE_RUNNING)
+    /* from here wakeups need signalling, but check for work flagged before that */
+    thread_atomic_swap (&worker->awake, 0);
+    if (global.running == ICE_RUNNING && worker->pending_clients == NULL &&
+            worker->recheck == 0 && worker->woken_count == 0)
     {
         uint64_t tm = timing_get_time();
         if (worker->wakeup_ms > tm)
@@ -466,6 +1038,12 @@ static client_t **worker_wait (worker_t *worker)
             duration = 60000;
     }
 
+#ifdef HAVE_SYS_EPOLL_H
+    worker_epoll_check (worker);
+    if (worker->epoll_fd >= 0)
+        ret = worker_epoll_wait (worker, duration);
+    else
+#endif
     ret = util_timed_wait_for_fd (worker->wakeup_fd[0], duration);
     if (ret > 0) /* may of been several wakeup attempts */
     {
@@ -477,18 +1055,20 @@ static client_t **worker_wait (worker_t *worker)
                 break;
             if (ret < 0 && sock_recoverable (sock_error()))
                 break;
-            sock_close (worker->wakeup_fd[1]);
-            sock_close (worker->wakeup_fd[0]);
+            worker_control_close (worker);
             worker_control_create (worker);
-            worker_wakeup (worker);
+            worker_signal (worker);
             WARN0 ("Had to recreate worker control feed");
         } while (1);
     }
 
+    worker->awake = 1;
     worker->time_ms = timing_get_time();
     worker->current_time.tv_sec = (time_t)(worker->time_ms/1000);
+    if (worker->bind_generation != worker_bind_generation)
+        worker_bind_cpu (worker);
 
-    return worker_add_pending_clients (worker);
+    worker_add_pending_clients (worker);
 }
 
 
@@ -496,90 +1076,140 @@ static void worker_relocate_clients (worker_t *worker)
 {
     if (workers == NULL)
         return;
+#ifdef HAVE_SYS_EPOLL_H
+    worker_epoll_release (worker);
+#endif
+    thread_spin_lock (&worker->woken_lock);
+    worker->woken_count = 0;
+    thread_spin_unlock (&worker->woken_lock);
     while (worker->count || worker->pending_count)
     {
-        client_t *client = worker->clients, **prevp = &worker->clients;
+        client_t *moved = NULL, *last = NULL;
+        int moved_count = 0;
 
         worker->wakeup_ms = worker->time_ms + 150;
-        while (client)
+        while (worker->timers_used)
         {
+            client_t *client = worker_timer_pop (worker);
+
             if (client->flags & CLIENT_ACTIVE)
             {
                 client->worker = workers;
-                prevp = &client->next_on_worker;
+                client->next_on_worker = moved;
+                moved = client;
+                if (last == NULL)
+                    last = client;
+                moved_count++;
             }
             else
-            {
-                *prevp = client->next_on_worker;
                 worker_add_client (worker, client);
-                worker->count--;
-            }
-            client = *prevp;
+            worker->count--;
         }
-        if (worker->clients)
+        if (moved)
         {
-            thread_spin_lock (&workers->lock);
-            *workers->pending_clients_tail = worker->clients;
-            workers->pending_clients_tail = prevp;
-            workers->pending_count += worker->count;
-            thread_spin_unlock (&workers->lock);
-            worker_wakeup (workers);
-            worker->clients = NULL;
-            worker->last_p = &worker->clients;
-            worker->count = 0;
+            worker_push_pending (workers, moved, last, moved_count);
+            worker_signal (workers);
         }
         worker_wait (worker);
     }
 }
 
+
+/* process the clients that are due, returns when the next one will be */
+static uint64_t worker_process_clients (worker_t *worker)
+{
+    uint64_t sched_ms = worker->time_ms + 2;
+    int i, due = 0;
+
+    if (worker->recheck || worker->running == 0)
+        worker_timer_recheck (worker);
+    worker_take_woken (worker);
+
+    /* take out those that are due first, so that none are processed twice */
+    while (worker->timers_used && worker->timers[0].due <= sched_ms)
+    {
+        if (due == worker->due_alloc)
+        {
+            int len = worker->due_alloc + 64;
+            client_t **arr = realloc (worker->due, len * sizeof (client_t *));
+            if (arr == NULL)
+                abort();
+            worker->due = arr;
+            worker->due_alloc = len;
+        }
+        worker->due [due++] = worker_timer_pop (worker);
+    }
+    worker->passes++;
+    worker->due_clients += due;
+    for (i = 0; i < due; i++)
+    {
+        client_t *client = worker->due [i];
+        int ret;
+
+        if (client->worker != worker) abort();
+        /* skip clients that are not ready yet or have been rescheduled later */
+        if ((client->flags & CLIENT_ACTIVE) == 0)
+        {
+            worker_timer_add (worker, client, WORKER_TIMER_IDLE);
+            continue;
+        }
+        if (worker->running && client->schedule_ms > sched_ms)
+        {
+            worker_timer_add (worker, client, client->schedule_ms);
+            continue;
+        }
+#ifdef HAVE_SYS_EPOLL_H
+        if (client->connection.polled)
+            worker_epoll_unpark (worker, client);
+        client->connection.write_blocked = 0;
+        client->connection.read_idle = 0;
+#endif
+        worker->sent_mark = client->connection.sent_bytes;
+        ret = client->ops->process (client);
+        /* a moved client may already be in use elsewhere. A kept alive
+         * connection adds its count in connection_keepalive before the reset */
+        if (ret <= 0 && client->connection.sent_bytes > worker->sent_mark)
+            worker->bytes_sent += client->connection.sent_bytes - worker->sent_mark;
+        if (ret < 0)
+        {
+            client->worker = NULL;
+            worker_drop_woken (worker, client);
+            if (client->ops->release)
+                client->ops->release (client);
+        }
+        if (ret)
+        {
+            if (ret > 0)
+                worker_drop_woken (worker, client);
+            worker->count--;
+            continue;
+        }
+#ifdef HAVE_SYS_EPOLL_H
+        if ((client->connection.write_blocked || client->connection.read_idle) &&
+                worker->epoll_fd >= 0 && worker->running)
+            worker_epoll_park (worker, client);
+#endif
+        worker_timer_add (worker, client, client->schedule_ms);
+    }
+    if (worker->timers_used && worker->timers[0].due < worker->time_ms + 60000)
+        return worker->timers[0].due;
+    return worker->time_ms + 60000;
+}
+
+
 void *worker (void *arg)
 {
     worker_t *worker = arg;
     long prev_count = -1;
-    client_t **prevp = &worker->clients;
 
     worker->running = 1;
     worker->wakeup_ms = (int64_t)0;
     worker->time_ms = timing_get_time();
+    worker_bind_cpu (worker);
 
     while (1)
     {
-        client_t *client = *prevp;
-        uint64_t sched_ms = worker->time_ms + 2;
-
-        while (client)
-        {
-            if (client->worker != worker) abort();
-            /* process client details but skip those that are not ready yet */
-            if (client->flags & CLIENT_ACTIVE)
-            {
-                int ret = 0;
-                client_t *nx = client->next_on_worker;
-
-                if (worker->running == 0 || client->schedule_ms <= sched_ms)
-                {
-                    ret = client->ops->process (client);
-                    if (ret < 0)
-                    {
-                        client->worker = NULL;
-                        if (client->ops->release)
-                            client->ops->release (client);
-                    }
-                    if (ret)
-                    {
-                        worker->count--;
-                        if (nx == NULL) /* is this the last client */
-                            worker->last_p = prevp;
-                        client = *prevp = nx;
-                        continue;
-                    }
-                }
-                if (client->schedule_ms < worker->wakeup_ms)
-                    worker->wakeup_ms = client->schedule_ms;
-            }
-            prevp = &client->next_on_worker;
-            client = *prevp;
-        }
+        worker->wakeup_ms = worker_process_clients (worker);
         worker->move_allocations = 0;
         if (prev_count != worker->count)
         {
@@ -593,7 +1223,7 @@ void *worker (void *arg)
             if (worker->count == 0 && worker->pending_count == 0)
                 break;
         }
-        prevp = worker_wait (worker);
+        worker_wait (worker);
     }
     worker_relocate_clients (worker);
     INFO0 ("shutting down");
@@ -605,10 +1235,15 @@ void *worker (void *arg)
 void worker_balance_trigger (time_t now)
 {
     int log_counts = (now % 10) == 0 ? 1 : 0;
+    worker_t *worker, *busiest;
 
+    thread_rwlock_rlock (&workers_lock);
+    worker_balance_sample ();
     if (worker_count == 1)
+    {
+        thread_rwlock_unlock (&workers_lock);
         return; // no balance required, leave quickly
-    thread_rwlock_rlock (&workers_lock);
+    }
 
     // lets only search for this once a second, not many times
     worker_least_used = find_least_busy_handler (log_counts);
@@ -620,6 +1255,14 @@ void worker_balance_trigger (time_t now)
     if (worker_balance_to_check == NULL)
         worker_balance_to_check = workers;
 
+    // the most loaded worker can always shed some clients
+    busiest = workers;
+    for (worker = workers->next; worker; worker = worker->next)
+        if (worker_load (worker) > worker_load (busiest))
+            busiest = worker;
+    if (worker_load (busiest) - worker_min_count > 20)
+        busiest->move_allocations = 20;
+
     thread_rwlock_unlock (&workers_lock);
 }
 
@@ -628,12 +1271,14 @@ static void worker_start (void)
 {
     worker_t *handler = calloc (1, sizeof(worker_t));
 
+#ifdef HAVE_SYS_EPOLL_H
+    handler->epoll_fd = -1;
+#endif
+    thread_spin_create (&handler->woken_lock);
     worker_control_create (handler);
 
-    handler->pending_clients_tail = &handler->pending_clients;
-    thread_spin_create (&handler->lock);
     thread_rwlock_wlock (&workers_lock);
-    handler->last_p = &handler->clients;
+    handler->cpu = worker_cpu_count ? worker_cpu_list [worker_count % worker_cpu_count] : -1;
     handler->next = workers;
     workers = handler;
     worker_count++;
@@ -662,10 +1307,18 @@ static void worker_stop (void)
     worker_wakeup (handler);
 
     thread_join (handler->thread);
-    thread_spin_destroy (&handler->lock);
+#ifdef HAVE_SYS_EPOLL_H
+    if (handler->epoll_fd >= 0)
+        close (handler->epoll_fd);
+#endif
 
-    sock_close (handler->wakeup_fd[1]);
-    sock_close (handler->wakeup_fd[0]);
+    worker_control_close (handler);
+    worker_wakeups_retired += handler->wakeups;
+    worker_coalesced_retired += handler->wakeups_coalesced;
+    thread_spin_destroy (&handler->woken_lock);
+    free (handler->timers);
+    free (handler->due);
+    free (handler->woken);
     free (handler);
 }
 
@@ -683,7 +1336,115 @@ void workers_adjust (int new_count)
 }
 
 
+/* only write to the control descriptor if the worker is not already flagged
+ * as awake, it will see any new work before it sleeps again */
+static void worker_signal (worker_t *worker)
+{
+    if (thread_atomic_cas (&worker->awake, 0, 1))
+    {
+        uint64_t v = 1;
+        pipe_write (worker->wakeup_fd[1], (void*)&v, sizeof (v));
+        thread_atomic_add (&worker->wakeups, 1);
+    }
+    else
+        thread_atomic_add (&worker->wakeups_coalesced, 1);
+}
+
+
+/* wake the worker for changes not tied to one client, such as it stopping,
+ * client_wakeup is for a client on the worker */
 void worker_wakeup (worker_t *worker)
 {
-    pipe_write (worker->wakeup_fd[1], "W", 1);
+    worker_signal (worker);
+}
+
+
+static void worker_stats_remove (int idx)
+{
+    static const char *names[] = { "clients", "load", "outgoing_kbitrate", "cpu_usage", "due_per_pass", NULL };
+    char name [40];
+    int i;
+
+    for (i = 0; names[i]; i++)
+    {
+        snprintf (name, sizeof name, "worker%d_%s", idx, names[i]);
+        stats_event (NULL, name, NULL);
+    }
+}
+
+
+void workers_stats (void)
+{
+    static int stats_count;
+    unsigned long wakeups = worker_wakeups_retired, coalesced = worker_coalesced_retired;
+    worker_t *worker;
+    int idx;
+
+    thread_rwlock_rlock (&workers_lock);
+    idx = worker_count;
+    for (worker = workers; worker; worker = worker->next)
+    {
+        char name [40];
+
+        wakeups += worker->wakeups;
+        coalesced += worker->wakeups_coalesced;
+
+        // the balancing inputs, numbered in the order the workers were started
+        idx--;
+        snprintf (name, sizeof name, "worker%d_clients", idx);
+        stats_event_args (NULL, name, "%d", worker->count + worker->pending_count);
+        snprintf (name, sizeof name, "worker%d_load", idx);
+        stats_event_args (NULL, name, "%d", worker_load (worker));
+        snprintf (name, sizeof name, "worker%d_outgoing_kbitrate", idx);
+        stats_event_args (NULL, name, "%" PRIu64, worker->bytes_rate * 8 / 1024);
+        snprintf (name, sizeof name, "worker%d_cpu_usage", idx);
+        stats_event_args (NULL, name, "%.1f", worker->cpu_rate / 10000.0);
+        snprintf (name, sizeof name, "worker%d_due_per_pass", idx);
+        stats_event_args (NULL, name, "%.2f", worker->due_per_pass / 100.0);
+    }
+    for (idx = worker_count; idx < stats_count; idx++)
+        worker_stats_remove (idx);
+    stats_count = worker_count;
+    thread_rwlock_unlock (&workers_lock);
+    stats_event_args (NULL, "worker_wakeups", "%lu", wakeups);
+    stats_event_args (NULL, "worker_wakeups_coalesced", "%lu", coalesced);
+}
+
+
+/* make a client due for processing from outside of its own processing. The
+ * client is listed for its worker, which moves it up its heap on the next pass.
+ * The worker thread is not woken, use client_wakeup for that.
+ */
+void client_schedule_now (client_t *client)
+{
+    worker_t *worker = client->worker;
+
+    if (worker == NULL)
+        return;
+    thread_spin_lock (&worker->woken_lock);
+    if (client->worker == worker)
+    {
+        if (worker->woken_count == worker->woken_alloc)
+        {
+            int len = worker->woken_alloc + 64;
+            client_t **arr = realloc (worker->woken, len * sizeof (client_t *));
+            if (arr == NULL)
+                abort();
+            worker->woken = arr;
+            worker->woken_alloc = len;
+        }
+        worker->woken [worker->woken_count++] = client;
+    }
+    thread_spin_unlock (&worker->woken_lock);
+}
+
+
+/* as client_schedule_now, but the worker is woken as well */
+void client_wakeup (client_t *client)
+{
+    worker_t *worker = client->worker;
+
+    client_schedule_now (client);
+    if (worker)
+        worker_signal (worker);
 }
@@ -33,13 +33,42 @@ struct _worker_t
     int running;
     int count, pending_count;
     int move_allocations;
-    spin_t lock;
     int wakeup_fd[2];
+    int awake;
+    int cpu, numa_local, bind_generation;
+    unsigned long wakeups, wakeups_coalesced;
+#ifdef HAVE_SYS_EPOLL_H
+    int epoll_fd;
+#endif
 
     client_t *pending_clients;
-    client_t **pending_clients_tail,
-             *clients;
-    client_t **last_p;
+
+    /* clients on this worker, ordered by when next due */
+    struct worker_timer
+    {
+        uint64_t due;
+        client_t *client;
+    } *timers;
+    int timers_used, timers_alloc;
+    client_t **due;
+    int due_alloc;
+    int recheck;
+
+    /* clients made due by other threads, moved up the heap on the next pass */
+    spin_t woken_lock;
+    client_t **woken;
+    int woken_count, woken_alloc;
+
+    /* balancing inputs, accumulated by the worker and sampled once a second */
+    uint64_t bytes_sent;
+    uint64_t sent_mark;     /* sent count of the client being processed, before the call */
+    unsigned long passes, due_clients;
+    uint64_t last_bytes, last_cpu_usec;
+    unsigned long last_passes, last_due_clients;
+    uint64_t bytes_rate, cpu_rate;
+    int due_per_pass;       /* x100 */
+    int load_factor;        /* cost of a client here relative to average, x1000 */
+
     thread_type *thread;
     struct timespec current_time;
     uint64_t time_ms;
@@ -50,6 +79,7 @@ struct _worker_t
 
 extern worker_t *workers;
 extern int worker_count;
+extern int worker_epoll;
 extern rwlock_t workers_lock;
 
 struct _client_functions
@@ -70,6 +100,9 @@ struct _client_tag
 
     client_t *next_on_worker;
 
+    /* position in the worker timer heap */
+    int timer_idx;
+
     /* functions to process client */
     struct _client_functions *ops;
 
@@ -120,6 +153,10 @@ struct _client_tag
 
     /* http response code for this client */
     int respcode;
+
+    /* requests handled on this connection, and any read after the current one */
+    unsigned int requests;
+    refbuf_t *pipelined;
 };
 
 void client_register (client_t *client);
@@ -140,9 +177,14 @@ int  client_compare (void *compare_arg, void *a, void *b);
 int  client_change_worker (client_t *client, worker_t *dest_worker);
 void client_add_worker (client_t *client);
 worker_t *worker_selected (void);
+int  worker_load (worker_t *worker);
 void worker_balance_trigger (time_t now);
 void workers_adjust (int new_count);
+void workers_config (struct ice_config_tag *config);
 void worker_wakeup (worker_t *worker);
+void client_schedule_now (client_t *client);
+void client_wakeup (client_t *client);
+void workers_stats (void);
 
 
 /* client flags bitmask */
@@ -157,6 +199,7 @@ void worker_wakeup (worker_t *worker);
 #define CLIENT_IP_BAN_LIFT          (1<<8)
 #define CLIENT_META_INSTREAM        (1<<9)
 #define CLIENT_HIJACKER             (1<<10)
+#define CLIENT_KEEPALIVE            (1<<11)
 #define CLIENT_FORMAT_BIT           (1<<16)
 
 #endif  /* __CLIENT_H__ */
@@ -24,9 +24,6 @@
 #endif
 #include <sys/types.h>
 #include <sys/stat.h>
-#ifdef HAVE_FNMATCH_H
-#include <fnmatch.h>
-#endif
 
 #ifdef _MSC_VER
  #include <winsock2.h>
@@ -59,6 +56,8 @@
 #include "global.h"
 #include "util.h"
 #include "connection.h"
+#include "iptrie.h"
+#include "strmatch.h"
 #include "refbuf.h"
 #include "client.h"
 #include "stats.h"
@@ -95,27 +94,42 @@
 
 static int  shoutcast_source_client (client_t *client);
 static int  http_client_request (client_t *client);
+static int  http_client_parse (client_t *client);
 static int  _handle_get_request (client_t *client);
 static int  _handle_source_request (client_t *client);
 static int  _handle_stats_request (client_t *client);
 
-struct banned_entry
+/* what was read from a list file, addresses and CIDR ranges go into the trie
+ * and anything else is compiled into one pattern matcher. Shared by snapshots
+ * until the file changes */
+typedef struct
 {
-    char ip[16]; // may want to expand later for ipv6
-    time_t timeout;
-};
+    int refcount;
+    iptrie *prefixes;
+    strmatch *patterns;
+} cache_entries;
+
+/* an immutable view of a list, replaced as a whole when the file changes or an
+ * entry is added/removed, so lookups only need a reference to it */
+typedef struct
+{
+    int refcount;
+    cache_entries *file;
+    iptrie *added;      /* entries added at runtime, eg timed bans */
+} cache_snapshot;
 
 typedef struct
 {
     time_t file_recheck;
     time_t file_mtime;
-    avl_tree *contents;
-    int  (*compare)(void *arg, void *a, void *b);
-    void (*add_new_entry)(avl_tree *t, const char *ip, time_t now);
+    cache_snapshot *snapshot;
+    int addresses;      /* entries can be IP addresses or prefixes */
     char *filename;
 } cache_file_contents;
 
 static spin_t _connection_lock;
+static spin_t _snapshot_lock;   /* taking a reference on a current snapshot */
+static mutex_t _cache_lock;     /* changes to the cached files */
 static uint64_t _current_id = 0;
 thread_type *conn_tid;
 int sigfd;
@@ -126,6 +140,30 @@ static SSL_CTX *ssl_ctx;
 #endif
 
 int header_timeout;
+static int keepalive_timeout;
+static unsigned int keepalive_requests;
+
+#if defined(HAVE_POLL) && defined(SO_REUSEPORT)
+#define ACCEPTORS_SHARED
+#endif
+#define ACCEPTORS_MAX   32
+#define ACCEPT_BATCH    100
+
+/* the threads accepting connections, the first is the connection thread itself
+ * using the global listening sockets, any others have their own sockets sharing
+ * the same ports. */
+struct acceptor
+{
+    thread_type *thread;
+    int running;
+    int count;
+    sock_t *socks;
+    listener_t **listeners;
+    uint64_t accepted, last_accepted, last_ms;
+};
+
+static struct acceptor acceptors [ACCEPTORS_MAX];
+static int acceptor_count;
 
 struct _client_functions shoutcast_source_ops =
 {
@@ -158,7 +196,6 @@ struct _client_functions http_req_stats_ops =
 
 /* filtering client connection based on IP */
 cache_file_contents banned_ip, allowed_ip;
-struct banned_entry *ban_entry_removal;
 
 /* filtering listener connection based on useragent */
 cache_file_contents useragents;
@@ -166,57 +203,15 @@ cache_file_contents useragents;
 int connection_running = 0;
 
 
-static int compare_pattern (void *arg, void *a, void *b)
-{
-    const char *value = (const char *)a;
-    const char *pattern = (const char *)b;
-#ifdef HAVE_FNMATCH_H
-    int x;
-
-    switch ((x = fnmatch (pattern, value, FNM_NOESCAPE)))
-    {
-        case FNM_NOMATCH:
-            x = strcmp (pattern, value);
-        case 0:
-            break;
-        default:
-            INFO0 ("fnmatch failed");
-            return -1;
-    }
-    return x;
-#else
-    return strcmp (pattern, value);
-#endif
-}
-
-static int compare_banned_ip (void *arg, void *a, void *b)
-{
-    struct banned_entry *this = (struct banned_entry *)a;
-    struct banned_entry *that = (struct banned_entry *)b;
-
-    if (ban_entry_removal == NULL)
-    {
-        time_t now = *((time_t*)arg);
-        if (that->timeout < now - 60)
-            ban_entry_removal = that; // identify possible removal
-    }
-    return compare_pattern (NULL, &this->ip[0] , &that->ip[0]);
-}
-
-static int free_filtered_line (void*x)
-{
-    free (x);
-    return 1;
-}
-
-
 void connection_initialize(void)
 {
     thread_spin_create (&_connection_lock);
+    thread_spin_create (&_snapshot_lock);
+    thread_mutex_create (&_cache_lock);
 
-    banned_ip.contents = NULL;
-    allowed_ip.contents = NULL;
-    useragents.contents = NULL;
+    banned_ip.snapshot = NULL;
+    allowed_ip.snapshot = NULL;
+    useragents.snapshot = NULL;
 
     conn_tid = NULL;
     connection_running = 0;
@@ -230,6 +225,8 @@ void connection_shutdown(void)
 {
     connection_listen_sockets_close (NULL, 1);
     thread_spin_destroy (&_connection_lock);
+    thread_spin_destroy (&_snapshot_lock);
+    thread_mutex_destroy (&_cache_lock);
 }
 
 static uint64_t _next_connection_id(void)
@@ -306,8 +303,10 @@ int connection_send_ssl (connection_t *con, const void *buf, size_t len)
     {
         switch (SSL_get_error (con->ssl, bytes))
         {
-            case SSL_ERROR_WANT_READ:
             case SSL_ERROR_WANT_WRITE:
+                con->write_blocked = 1;
+                return -1;
+            case SSL_ERROR_WANT_READ:
                 return -1;
         }
         con->error = 1;
@@ -347,6 +346,8 @@ int connection_send (connection_t *con, const void *buf, size_t len)
     {
         if (!sock_recoverable (sock_error()))
             con->error = 1;
+        else
+            con->write_blocked = 1;
     }
     else
         con->sent_bytes += bytes;
@@ -373,9 +374,19 @@ void connection_bufs_init (struct connection_bufs *v, short start)
 }
 
 
+/* as above but use the provided array first, only allocating if more is needed */
+void connection_bufs_init_on (struct connection_bufs *v, IOVEC *space, short count)
+{
+    memset (v, 0, sizeof (struct connection_bufs));
+    v->block = v->initial = space;
+    v->max = count;
+}
+
+
 void connection_bufs_release (struct connection_bufs *v)
 {
-    free (v->block);
+    if (v->block != v->initial)
+        free (v->block);
     memset (v, 0, sizeof (struct connection_bufs));
 }
 
@@ -392,7 +403,15 @@ int connection_bufs_append (struct connection_bufs *v, void *buf, unsigned int l
     if (v->count >= v->max)
     {
        int len = v->max + 16;
-       IOVEC *arr = realloc (v->block, (len*sizeof(IOVEC)));
+       IOVEC *arr;
+
+       if (v->initial && v->block == v->initial)
+       {
+           arr = malloc (len*sizeof(IOVEC));
+           memcpy (arr, v->block, v->count*sizeof(IOVEC));
+       }
+       else
+           arr = realloc (v->block, (len*sizeof(IOVEC)));
        v->max = len;
        v->block = arr;
     }
@@ -405,6 +424,22 @@ int connection_bufs_append (struct connection_bufs *v, void *buf, unsigned int l
 }
 
 
+/* gather the blocks into the one buffer, which must be big enough */
+int connection_bufs_copy (struct connection_bufs *v, void *dst)
+{
+    IOVEC *p = v->block;
+    char *d = dst;
+    int i = v->count;
+
+    for (; i; i--, p++)
+    {
+        memcpy (d, IO_VECTOR_BASE (p), IO_VECTOR_LEN (p));
+        d += IO_VECTOR_LEN (p);
+    }
+    return v->total;
+}
+
+
 static int connbufs_locate_start (struct connection_bufs *vects, int skip, IOVEC *old_value, int *offp)
 {
     int sum = 0, i = vects->count;
@@ -447,8 +482,13 @@ int connection_bufs_send (connection_t *con, struct connection_bufs *vectors, in
         if (not_ssl_connection (con))
         {
             ret = sock_writev (con->sock, p, vectors->count - i);
-            if (ret < 0 && !sock_recoverable (sock_error()))
-                con->error = 1;
+            if (ret < 0)
+            {
+                if (!sock_recoverable (sock_error()))
+                    con->error = 1;
+                else
+                    con->write_blocked = 1;
+            }
         }
 #ifdef HAVE_OPENSSL
         else
@@ -473,59 +513,228 @@ int connection_bufs_send (connection_t *con, struct connection_bufs *vectors, in
 }
 
 
-static void add_generic_text (avl_tree *t, const char *ip, time_t now)
+static void cache_entries_release (cache_entries *entries)
+{
+    if (entries && thread_atomic_sub (&entries->refcount, 1) == 0)
+    {
+        iptrie_free (entries->prefixes);
+        strmatch_free (entries->patterns);
+        free (entries);
+    }
+}
+
+/* get a reference to the current contents, NULL if there are none */
+static cache_snapshot *cache_snapshot_get (cache_file_contents *cache)
 {
-    char *str = strdup (ip);
-    if (str)
-        avl_insert (t, str);
+    cache_snapshot *snapshot;
+
+    thread_spin_lock (&_snapshot_lock);
+    snapshot = cache->snapshot;
+    if (snapshot)
+        thread_atomic_add (&snapshot->refcount, 1);
+    thread_spin_unlock (&_snapshot_lock);
+    return snapshot;
 }
 
-static void add_banned_ip (avl_tree *t, const char *ip, time_t now)
+static void cache_snapshot_release (cache_snapshot *snapshot)
 {
-    if (t)
+    if (snapshot && thread_atomic_sub (&snapshot->refcount, 1) == 0)
     {
-        struct banned_entry *entry = calloc (1, sizeof (struct banned_entry));
-        snprintf (&entry->ip[0], sizeof (entry->ip), "%s", ip);
-        if (now)
-            entry->timeout = now;
-        avl_insert (t, entry);
+        cache_entries_release (snapshot->file);
+        iptrie_free (snapshot->added);
+        free (snapshot);
     }
 }
 
+/* make the file entries and added trie the current contents, taking over the
+ * references passed. lookups still using the previous contents keep them until
+ * released. Called with the cache lock held */
+static void cache_publish (cache_file_contents *cache, cache_entries *file, iptrie *added)
+{
+    cache_snapshot *snapshot = NULL, *old;
+
+    if (added && added->count == 0)
+    {
+        iptrie_free (added);
+        added = NULL;
+    }
+    if (file || added)
+    {
+        snapshot = calloc (1, sizeof (*snapshot));
+        snapshot->refcount = 1;
+        snapshot->file = file;
+        snapshot->added = added;
+    }
+    thread_spin_lock (&_snapshot_lock);
+    old = cache->snapshot;
+    cache->snapshot = snapshot;
+    thread_spin_unlock (&_snapshot_lock);
+    cache_snapshot_release (old);
+}
+
+/* reference to the current file entries for making a new snapshot */
+static cache_entries *cache_file_entries (cache_file_contents *cache)
+{
+    cache_entries *file = cache->snapshot ? cache->snapshot->file : NULL;
+
+    if (file)
+        thread_atomic_add (&file->refcount, 1);
+    return file;
+}
+
+/* check the value against the snapshot, returns non-zero on a match. For address
+ * entries the timeout of the entry can be returned, read only as the snapshot is shared */
+static int cache_match (cache_snapshot *snapshot, const char *value, time_t now, time_t **timeout)
+{
+    cache_entries *file = snapshot->file;
+
+    if (snapshot->added || (file && file->prefixes))
+    {
+        unsigned char addr [IPTRIE_ADDR_LEN];
+        int bits;
+
+        if (iptrie_parse (value, addr, &bits) == 0)
+        {
+            time_t *match = iptrie_match (snapshot->added, addr, now);
+
+            if (match == NULL && file)
+                match = iptrie_match (file->prefixes, addr, now);
+            if (match)
+            {
+                if (timeout) *timeout = match;
+                return 1;
+            }
+        }
+    }
+    if (file && strmatch_find (file->patterns, value))
+        return 1;
+    return 0;
+}
+
+
 void connection_add_banned_ip (const char *ip, int duration)
 {
-    time_t timeout = 0;
+    time_t now = time(NULL), timeout = 0;
+    unsigned char addr [IPTRIE_ADDR_LEN];
+    int bits;
+
     if (duration > 0)
-        timeout = time(NULL) + duration;
+        timeout = now + duration;
+    if (iptrie_parse (ip, addr, &bits) < 0)
+        return;
 
-    if (banned_ip.contents)
+    thread_mutex_lock (&_cache_lock);
+    do
     {
-        global_lock();
-        add_banned_ip (banned_ip.contents, ip, timeout);
-        global_unlock();
+        iptrie *added = iptrie_copy (banned_ip.snapshot ? banned_ip.snapshot->added : NULL, now);
+
+        if (added == NULL)
+            break;
+        iptrie_insert (added, addr, bits, timeout);
+        cache_publish (&banned_ip, cache_file_entries (&banned_ip), added);
+    } while (0);
+    thread_mutex_unlock (&_cache_lock);
+}
+
+/* push back the timeout of a timed ban covering ip. The published list is
+ * not changed, a copy with the later timeout replaces it */
+static void extend_banned_ip (const char *ip, time_t timeout)
+{
+    time_t now = time(NULL);
+    unsigned char addr [IPTRIE_ADDR_LEN];
+    int bits;
+
+    if (iptrie_parse (ip, addr, &bits) < 0)
+        return;
+    thread_mutex_lock (&_cache_lock);
+    if (banned_ip.snapshot && banned_ip.snapshot->added)
+    {
+        iptrie *added = iptrie_copy (banned_ip.snapshot->added, now);
+
+        if (added)
+        {
+            time_t *match = iptrie_match (added, addr, now);
+
+            if (match && *match && *match < timeout)
+                *match = timeout;
+            cache_publish (&banned_ip, cache_file_entries (&banned_ip), added);
+        }
     }
+    thread_mutex_unlock (&_cache_lock);
 }
 
 void connection_release_banned_ip (const char *ip)
 {
-    if (banned_ip.contents)
+    unsigned char addr [IPTRIE_ADDR_LEN];
+    int bits;
+
+    if (iptrie_parse (ip, addr, &bits) < 0)
+        return;
+    thread_mutex_lock (&_cache_lock);
+    if (banned_ip.snapshot && banned_ip.snapshot->added)
     {
-        global_lock();
-        avl_delete (banned_ip.contents, (void*)ip, free_filtered_line);
-        global_unlock();
+        iptrie *added = iptrie_copy (banned_ip.snapshot->added, time(NULL));
+
+        if (added)
+        {
+            iptrie_remove (added, addr, bits);
+            cache_publish (&banned_ip, cache_file_entries (&banned_ip), added);
+        }
     }
+    thread_mutex_unlock (&_cache_lock);
 }
 
 void connection_stats (void)
 {
+    static int stats_count;
+    uint64_t now = timing_get_time();
     long banned_IPs = 0;
-    if (banned_ip.contents)
-        banned_IPs = (long)banned_ip.contents->length;
+    int i, count = acceptor_count;
+    cache_snapshot *bans = cache_snapshot_get (&banned_ip);
+
+    if (bans)
+    {
+        if (bans->added)
+            banned_IPs += bans->added->count;
+        if (bans->file && bans->file->prefixes)
+            banned_IPs += bans->file->prefixes->count;
+        if (bans->file)
+            banned_IPs += strmatch_count (bans->file->patterns);
+    }
+    cache_snapshot_release (bans);
     stats_event_args (NULL, "banned_IPs", "%ld", banned_IPs);
+
+    for (i = 0; i < count; i++)
+    {
+        struct acceptor *acceptor = &acceptors [i];
+        uint64_t accepted = acceptor->accepted, rate = 0;
+        char name [40];
+
+        if (acceptor->last_ms && now > acceptor->last_ms)
+            rate = (accepted - acceptor->last_accepted) * 1000 / (now - acceptor->last_ms);
+        acceptor->last_accepted = accepted;
+        acceptor->last_ms = now;
+
+        snprintf (name, sizeof name, "acceptor%d_connections", i);
+        stats_event_args (NULL, name, "%" PRIu64, accepted);
+        snprintf (name, sizeof name, "acceptor%d_accept_rate", i);
+        stats_event_args (NULL, name, "%" PRIu64, rate);
+    }
+    for (i = count; i < stats_count; i++)
+    {
+        char name [40];
+
+        snprintf (name, sizeof name, "acceptor%d_connections", i);
+        stats_event (NULL, name, NULL);
+        snprintf (name, sizeof name, "acceptor%d_accept_rate", i);
+        stats_event (NULL, name, NULL);
+    }
+    stats_count = count;
 }
 
-/* function to handle the re-populating of the avl tree containing IP addresses
+/* function to handle the re-populating of the lists containing IP addresses
  * for deciding whether a connection of an incoming request is to be dropped.
+ * Called with the cache lock held.
  */
 static void recheck_cached_file (cache_file_contents *cache, time_t now)
 {
@@ -534,17 +743,22 @@ static void recheck_cached_file (cache_file_contents *cache, time_t now)
         struct stat file_stat;
         FILE *file = NULL;
         int count = 0;
-        avl_tree *new_ips;
+        cache_entries *entries;
+        iptrie *added = cache->snapshot ? cache->snapshot->added : NULL;
         char line [MAX_LINE_LEN];
 
         cache->file_recheck = now + 10;
+        if (added && added->expires && added->expires < now - 60)
+        {
+            /* drop any timed entries that have run out */
+            cache_publish (cache, cache_file_entries (cache), iptrie_copy (added, now));
+            /* an empty trie is not kept, so use what was published */
+            added = cache->snapshot ? cache->snapshot->added : NULL;
+        }
         if (cache->filename == NULL)
         {
-            if (cache->contents)
-            {
-                avl_tree_free (cache->contents, free_filtered_line);
-                cache->contents = NULL;
-            }
+            if (cache->snapshot && cache->snapshot->file)
+                cache_publish (cache, NULL, iptrie_copy (added, now));
             return;
         }
         if (stat (cache->filename, &file_stat) < 0)
@@ -564,71 +778,89 @@ static void recheck_cached_file (cache_file_contents *cache, time_t now)
             return;
         }
 
-        new_ips = avl_tree_new (cache->compare, &cache->file_recheck);
+        entries = calloc (1, sizeof (*entries));
+        entries->refcount = 1;
+        if (cache->addresses)
+            entries->prefixes = iptrie_new ();
+        entries->patterns = strmatch_new ();
 
         while (get_line (file, line, MAX_LINE_LEN))
         {
+            unsigned char addr [IPTRIE_ADDR_LEN];
+            int bits;
+
             if(!line[0] || line[0] == '#')
                 continue;
             count++;
-            cache->add_new_entry (new_ips, line, 0);
+            if (entries->prefixes && iptrie_parse (line, addr, &bits) == 0)
+                iptrie_insert (entries->prefixes, addr, bits, 0);
+            else
+                strmatch_add (entries->patterns, line);
         }
         fclose (file);
-        INFO2 ("%d entries read from file \"%s\"", count, cache->filename);
+        if (strmatch_compile (entries->patterns) < 0)
+            WARN1 ("patterns in \"%s\" are too many to combine, checking each in turn", cache->filename);
+        if (entries->prefixes)
+        {
+            iptrie_compact (entries->prefixes);
+            INFO3 ("%d entries read from file \"%s\", %ld addresses/prefixes", count,
+                    cache->filename, entries->prefixes->count);
+        }
+        else
+            INFO2 ("%d entries read from file \"%s\"", count, cache->filename);
 
-        if (cache->contents) avl_tree_free (cache->contents, free_filtered_line);
-        cache->contents = new_ips;
+        cache_publish (cache, entries, iptrie_copy (added, now));
     }
 }
 
 
+/* check the ban/allow/useragent files for changes, done away from the accept
+ * path so that accepting never waits on the file reading. */
+void connection_recheck_files (time_t now)
+{
+    thread_mutex_lock (&_cache_lock);
+    recheck_cached_file (&banned_ip, now);
+    recheck_cached_file (&allowed_ip, now);
+    recheck_cached_file (&useragents, now);
+    thread_mutex_unlock (&_cache_lock);
+}
+
+
 /* return 0 if the passed ip address is not to be handled by icecast, non-zero otherwise */
 static int accept_ip_address (char *ip)
 {
-    void *result;
     time_t now = time(NULL);
+    cache_snapshot *snapshot = cache_snapshot_get (&banned_ip);
 
-    global_lock();
-    recheck_cached_file (&banned_ip, now);
-
-    if (banned_ip.contents)
+    if (snapshot)
     {
-        ban_entry_removal = NULL;
-        if (avl_get_by_key (banned_ip.contents, ip, &result) == 0)
-        {
-            struct banned_entry *match = result;
-            if (match->timeout == 0 || match->timeout > now)
-            {
-                if (match->timeout && now + 900 > match->timeout)
-                    match->timeout = now + 900;
-                global_unlock();
-                DEBUG1 ("%s banned", ip);
-                return 0;
-            }
-            avl_delete (banned_ip.contents, ip, free_filtered_line);
-        }
-        /* we may of seen another one to remove */
-        if (ban_entry_removal)
+        time_t *timeout = NULL;
+
+        if (cache_match (snapshot, ip, now, &timeout))
         {
-            INFO1 ("removing %s from ban list for now", &ban_entry_removal->ip[0]);
-            avl_delete (banned_ip.contents, &ban_entry_removal->ip[0], free_filtered_line);
-            ban_entry_removal = NULL;
+            /* keep extending timed bans while the address keeps trying, at
+             * most every 5 minutes as the list has to be copied */
+            int extend = (timeout && *timeout && *timeout < now + 600);
+
+            cache_snapshot_release (snapshot);
+            if (extend)
+                extend_banned_ip (ip, now + 900);
+            DEBUG1 ("%s banned", ip);
+            return 0;
         }
+        cache_snapshot_release (snapshot);
     }
-    global_unlock();
-    recheck_cached_file (&allowed_ip, now);
-    if (allowed_ip.contents)
+    snapshot = cache_snapshot_get (&allowed_ip);
+    if (snapshot)
     {
-        if (avl_get_by_key (allowed_ip.contents, ip, &result) == 0)
-        {
+        int ret = cache_match (snapshot, ip, now, NULL);
+
+        cache_snapshot_release (snapshot);
+        if (ret)
             DEBUG1 ("%s is allowed", ip);
-            return 1;
-        }
         else
-        {
             DEBUG1 ("%s is not allowed", ip);
-            return 0;
-        }
+        return ret;
     }
     return 1;
 }
@@ -683,7 +915,8 @@ void connection_close_sigfd (void)
 #define connection_close_sigfd()    do {}while(0);
 #endif
 
-static sock_t wait_for_serversock (void)
+/* wait for a connection, returning the index of the listening socket or -1 */
+static int wait_for_serversock (void)
 {
 #ifdef HAVE_POLL
     int i, ret;
@@ -704,7 +937,7 @@ static sock_t wait_for_serversock (void)
 #endif
 
     if (ret <= 0)
-        return SOCK_ERROR;
+        return -1;
     else {
         int dst;
 #ifdef HAVE_SIGNALFD
@@ -740,7 +973,7 @@ static sock_t wait_for_serversock (void)
 #endif
         for(i=0; i < global.server_sockets; i++) {
             if(ufds[i].revents & POLLIN)
-                return ufds[i].fd;
+                return i;
             if(ufds[i].revents & (POLLHUP|POLLERR|POLLNVAL))
             {
                 if (ufds[i].revents & (POLLHUP|POLLERR))
@@ -761,7 +994,7 @@ static sock_t wait_for_serversock (void)
             dst++;
         }
         global.server_sockets = dst;
-        return SOCK_ERROR;
+        return -1;
     }
 #else
     fd_set rfds;
@@ -782,50 +1015,50 @@ static sock_t wait_for_serversock (void)
 
     ret = select(max+1, &rfds, NULL, NULL, &tv);
     if(ret < 0) {
-        return SOCK_ERROR;
+        return -1;
     }
     else if(ret == 0) {
-        return SOCK_ERROR;
+        return -1;
     }
     else {
         for(i=0; i < global.server_sockets; i++) {
             if(FD_ISSET(global.serversock[i], &rfds))
-                return global.serversock[i];
+                return i;
         }
-        return SOCK_ERROR; /* Should be impossible, stop compiler warnings */
+        return -1; /* Should be impossible, stop compiler warnings */
     }
 #endif
 }
 
 
-static client_t *accept_client (void)
+/* accept a connection from the listening socket and hand it to a worker, -1
+ * is returned if there was none to take */
+static int accept_client (sock_t serversock, listener_t *listener)
 {
     client_t *client = NULL;
-    sock_t sock, serversock = wait_for_serversock ();
+    sock_t sock;
     char addr [200];
 
-    if (serversock == SOCK_ERROR)
-        return NULL;
-
     sock = sock_accept (serversock, addr, 200);
     if (sock == SOCK_ERROR)
     {
         if (sock_recoverable (sock_error()))
-            return NULL;
+            return -1;
         WARN2 ("accept() failed with error %d: %s", sock_error(), strerror(sock_error()));
         thread_sleep (500000);
-        return NULL;
+        return -1;
     }
     do
     {
-        int i, num;
         refbuf_t *r;
 
+#ifndef HAVE_ACCEPT4
         if (sock_set_blocking (sock, 0)) // || sock_set_nodelay (sock))
         {
             WARN0 ("failed to set tcp options on client connection, dropping");
             break;
         }
+#endif
         client = calloc (1, sizeof (client_t));
         if (client == NULL || connection_init (&client->connection, sock, addr) < 0)
             break;
@@ -836,34 +1069,178 @@ static client_t *accept_client (void)
         global_lock ();
         client_register (client);
 
-        for (i=0; i < global.server_sockets; i++)
-        {
-            if (global.serversock[i] == serversock)
-            {
-                client->server_conn = global.server_conn[i];
-                client->server_conn->refcount++;
-                if (client->server_conn->ssl && ssl_ok)
-                    connection_uses_ssl (&client->connection);
-                if (client->server_conn->shoutcast_compat)
-                    client->ops = &shoutcast_source_ops;
-                else
-                    client->ops = &http_request_ops;
-                break;
-            }
-        }
-        num = global.clients;
+        client->server_conn = listener;
+        listener->refcount++;
+        if (listener->ssl && ssl_ok)
+            connection_uses_ssl (&client->connection);
+        if (listener->shoutcast_compat)
+            client->ops = &shoutcast_source_ops;
+        else
+            client->ops = &http_request_ops;
         global_unlock ();
-        stats_event_args (NULL, "clients", "%d", num);
         client->flags |= CLIENT_ACTIVE;
-        return client;
+
+        /* do a small delay here so the client has chance to send the request after
+         * getting a connect. */
+        client->counter = client->schedule_ms = timing_get_time();
+        client->connection.con_time = client->schedule_ms/1000;
+        client->connection.discon_time = client->connection.con_time + header_timeout;
+        client->schedule_ms += 6;
+        client_add_worker (client);
+        stats_counter_inc (STATS_CTR_CONNECTIONS);
+        return 0;
     } while (0);
 
     free (client);
     sock_close (sock);
+    return 0;
+}
+
+
+/* take the connections waiting on the listening socket, up to a limit so that
+ * the other sockets are not held up */
+static void accept_pending (struct acceptor *acceptor, sock_t serversock, listener_t *listener)
+{
+    int loop = ACCEPT_BATCH;
+
+    while (loop-- && connection_running)
+    {
+        if (accept_client (serversock, listener) < 0)
+            break;
+        acceptor->accepted++;
+        if (global.new_connections_slowdown)
+            thread_sleep (global.new_connections_slowdown * 5000);
+    }
+}
+
+
+#ifdef ACCEPTORS_SHARED
+static void *acceptor_thread (void *arg)
+{
+    struct acceptor *acceptor = arg;
+    struct pollfd ufds [acceptor->count];
+    int i;
+
+    for (i = 0; i < acceptor->count; i++)
+    {
+        ufds[i].fd = acceptor->socks[i];
+        ufds[i].events = POLLIN;
+    }
+    while (acceptor->running && connection_running)
+    {
+        if (poll (ufds, acceptor->count, 333) <= 0)
+            continue;
+        for (i = 0; i < acceptor->count; i++)
+        {
+            if (ufds[i].revents & POLLIN)
+                accept_pending (acceptor, acceptor->socks[i], acceptor->listeners[i]);
+            else if (ufds[i].revents & (POLLHUP|POLLERR|POLLNVAL))
+            {
+                WARN1 ("problem with listening socket on port %d, ignoring", acceptor->listeners[i]->port);
+                ufds[i].fd = -1;
+            }
+        }
+    }
     return NULL;
 }
 
 
+/* open the sockets for the extra acceptors, each with its own socket on the
+ * ports of the global listening sockets. This is done along with the global
+ * sockets so that any change of user happens afterwards, as the kernel only
+ * lets the same user share a port. */
+static void acceptors_open (int count)
+{
+    int i, j, sockets;
+
+    if (acceptor_count > 1)
+        return;
+    global_lock();
+    sockets = global.server_sockets;
+    for (i = 1; i < count && i < ACCEPTORS_MAX; i++)
+    {
+        struct acceptor *acceptor = &acceptors [i];
+
+        memset (acceptor, 0, sizeof (*acceptor));
+        acceptor->socks = calloc (sockets, sizeof (sock_t));
+        acceptor->listeners = calloc (sockets, sizeof (listener_t *));
+        for (j = 0; j < sockets; j++)
+        {
+            listener_t *listener = global.server_conn [j];
+            sock_t sock = sock_get_server_socket (listener->port, listener->bind_address, 1);
+
+            if (sock == SOCK_ERROR || sock_listen (sock, listener->qlen) == 0)
+            {
+                if (i == 1)
+                    WARN1 ("port %d cannot be shared with more acceptors", listener->port);
+                if (sock != SOCK_ERROR)
+                    sock_close (sock);
+                continue;
+            }
+            if (listener->so_sndbuf)
+                sock_set_send_buffer (sock, listener->so_sndbuf);
+            sock_set_blocking (sock, 0);
+            acceptor->socks [acceptor->count] = sock;
+            acceptor->listeners [acceptor->count] = listener;
+            listener->refcount++;
+            acceptor->count++;
+        }
+        acceptor->running = 1;
+        acceptor_count = i + 1;
+    }
+    global_unlock();
+}
+
+
+/* start the threads for the acceptors opened with the listening sockets */
+static void acceptors_start (void)
+{
+    int i;
+
+    for (i = 1; i < acceptor_count; i++)
+    {
+        if (acceptors[i].count)
+            acceptors[i].thread = thread_create ("acceptor", acceptor_thread, &acceptors[i], THREAD_ATTACHED);
+    }
+    if (acceptor_count > 1)
+        INFO1 ("%d threads accepting connections", acceptor_count);
+}
+
+
+static void acceptors_stop (void)
+{
+    int i, j;
+
+    for (i = 1; i < acceptor_count; i++)
+    {
+        struct acceptor *acceptor = &acceptors [i];
+
+        acceptor->running = 0;
+        if (acceptor->thread)
+            thread_join (acceptor->thread);
+        acceptor->thread = NULL;
+        global_lock();
+        for (j = 0; j < acceptor->count; j++)
+        {
+            sock_close (acceptor->socks [j]);
+            config_clear_listener (acceptor->listeners [j]);
+        }
+        global_unlock();
+        free (acceptor->socks);
+        free (acceptor->listeners);
+        acceptor->socks = NULL;
+        acceptor->listeners = NULL;
+        acceptor->count = 0;
+    }
+    acceptor_count = 1;
+}
+#else
+#define acceptors_open(x)       do {} while (0)
+#define acceptors_start()       do {} while (0)
+#define acceptors_stop()        do {} while (0)
+#endif
+
+
 /* shoutcast source clients are handled specially because the protocol is limited. It is
  * essentially a password followed by a series of headers, each on a separate line.  In here
  * we get the password and build a http request like a native source client would do
@@ -951,10 +1328,10 @@ static int http_client_request (client_t *client)
         char *buf = refbuf->data + refbuf->len;
 
         ret = client_read_bytes (client, buf, remaining);
+        if (ret < 0 && refbuf->len && client->requests && client->connection.error == 0)
+            return http_client_parse (client); /* pipelined after the previous request */
         if (ret > 0)
         {
-            char *ptr;
-
             buf [ret] = '\0';
             refbuf->len += ret;
             if (memcmp (refbuf->data, "<policy-file-request/>", 23) == 0)
@@ -967,89 +1344,20 @@ static int http_client_request (client_t *client)
                 client->respcode = 200;
                 refbuf_release (refbuf);
                 client->shared_data = NULL;
+                if (client->parser)
+                    httpp_destroy (client->parser);
+                client->parser = NULL;
                 client->check_buffer = format_generic_write_to_client;
                 return fserve_setup_client_fb (client, &fb);
             }
-            /* find a blank line */
-            do
-            {
-                buf = refbuf->data;
-                ptr = strstr (buf, "\r\n\r\n");
-                if (ptr)
-                {
-                    ptr += 4;
-                    break;
-                }
-                ptr = strstr (buf, "\n\n");
-                if (ptr)
-                {
-                    ptr += 2;
-                    break;
-                }
-                ptr = strstr (buf, "\r\r\n\r\r\n");
-                if (ptr)
-                {
-                    ptr += 6;
-                    break;
-                }
-                client->schedule_ms = client->worker->time_ms + 100;
-                return 0;
-            } while (0);
-            client->refbuf = client->shared_data;
-            client->shared_data = NULL;
-            client->connection.discon_time = 0;
-            client->parser = httpp_create_parser();
-            httpp_initialize (client->parser, NULL);
-            if (httpp_parse (client->parser, refbuf->data, refbuf->len))
-            {
-                recheck_cached_file (&useragents, client->worker->current_time.tv_sec);
-                if (useragents.contents)
-                {
-                    const char *agent = httpp_getvar (client->parser, "user-agent");
-                    void *result;
-
-                    if (agent && avl_get_by_key (useragents.contents, (char *)agent, &result) == 0)
-                    {
-                        INFO2 ("dropping client at %s because useragent is %s",
-                                client->connection.ip, agent);
-                        return -1;
-                    }
-                }
-
-                /* headers now parsed, make sure any sent content is next */
-                if (strcmp("ICE",  httpp_getvar (client->parser, HTTPP_VAR_PROTOCOL)) &&
-                        strcmp("HTTP", httpp_getvar (client->parser, HTTPP_VAR_PROTOCOL)))
-                {
-                    ERROR0("Bad HTTP protocol detected");
-                    return -1;
-                }
-                auth_check_http (client);
-                switch (client->parser->req_type)
-                {
-                    case httpp_req_get:
-                        refbuf->len = PER_CLIENT_REFBUF_SIZE;
-                        client->ops = &http_req_get_ops;
-                        break;
-                    case httpp_req_source:
-                        client->pos = ptr - refbuf->data;
-                        client->ops = &http_req_source_ops;
-                        break;
-                    case httpp_req_stats:
-                        refbuf->len = PER_CLIENT_REFBUF_SIZE;
-                        client->ops = &http_req_stats_ops;
-                        break;
-                    default:
-                        WARN1("unhandled request type from %s", client->connection.ip);
-                        return client_send_501 (client);
-                }
-                client->counter = 0;
-                return client->ops->process(client);
-            }
-            /* invalid http request */
-            return -1;
+            return http_client_parse (client);
         }
         if (ret && client->connection.error == 0)
         {
+            /* nothing yet of a further request on a kept alive connection, so
+             * the worker can wait on the socket if it is able to */
+            if (client->requests && refbuf->len == 0)
+                client->connection.read_idle = 1;
             /* scale up the retry time, very short initially, usual case */
             uint64_t diff = client->worker->time_ms - client->counter;
             diff >>= 1;
@@ -1065,6 +1373,169 @@ static int http_client_request (client_t *client)
 }
 
 
+/* can the connection be kept open for a further request after this one */
+static int http_keepalive_wanted (client_t *client)
+{
+    const char *version = httpp_getvar (client->parser, HTTPP_VAR_VERSION);
+    const char *conn = httpp_getvar (client->parser, "connection");
+
+    if (keepalive_timeout <= 0 || client->requests >= keepalive_requests)
+        return 0;
+    if (strcmp ("HTTP", httpp_getvar (client->parser, HTTPP_VAR_PROTOCOL)) || version == NULL)
+        return 0;
+    if (strcmp (version, "1.1") == 0)
+        return conn == NULL || strcasecmp (conn, "close") != 0;
+    return conn && strcasecmp (conn, "keep-alive") == 0;
+}
+
+
+/* check the request read so far, dispatching it once the headers are complete */
+static int http_client_parse (client_t *client)
+{
+    refbuf_t *refbuf = client->shared_data;
+    char *ptr;
+    int len;
+
+    /* the parser picks up from where the previous read got to */
+    if (client->parser == NULL)
+    {
+        client->parser = httpp_create_parser();
+        httpp_initialize (client->parser, NULL);
+    }
+    len = httpp_scan (client->parser, refbuf->data, refbuf->len);
+    if (len < 0)
+        return -1;
+    if (len == 0)
+    {
+        client->schedule_ms = client->worker->time_ms + 100;
+        return 0;
+    }
+    ptr = refbuf->data + len;
+    client->refbuf = client->shared_data;
+    client->shared_data = NULL;
+    client->connection.discon_time = 0;
+    if (httpp_parse (client->parser, refbuf->data, refbuf->len))
+    {
+        cache_snapshot *agents = cache_snapshot_get (&useragents);
+        if (agents)
+        {
+            const char *agent = httpp_getvar (client->parser, "user-agent");
+
+            if (agent && cache_match (agents, agent, 0, NULL))
+            {
+                cache_snapshot_release (agents);
+                INFO2 ("dropping client at %s because useragent is %s",
+                        client->connection.ip, agent);
+                return -1;
+            }
+            cache_snapshot_release (agents);
+        }
+
+        /* headers now parsed, make sure any sent content is next */
+        if (strcmp("ICE",  httpp_getvar (client->parser, HTTPP_VAR_PROTOCOL)) &&
+                strcmp("HTTP", httpp_getvar (client->parser, HTTPP_VAR_PROTOCOL)))
+        {
+            ERROR0("Bad HTTP protocol detected");
+            return -1;
+        }
+        auth_check_http (client);
+        switch (client->parser->req_type)
+        {
+            case httpp_req_get:
+                client->requests++;
+                if (http_keepalive_wanted (client))
+                {
+                    int extra = refbuf->len - (ptr - refbuf->data);
+
+                    /* keep any following request, the buffer is reused for the response */
+                    client->flags |= CLIENT_KEEPALIVE;
+                    if (extra > 0)
+                    {
+                        client->pipelined = refbuf_new (PER_CLIENT_REFBUF_SIZE);
+                        memcpy (client->pipelined->data, ptr, extra);
+                        client->pipelined->data [extra] = '\0';
+                        client->pipelined->len = extra;
+                    }
+                }
+                refbuf->len = PER_CLIENT_REFBUF_SIZE;
+                client->ops = &http_req_get_ops;
+                break;
+            case httpp_req_source:
+                client->pos = ptr - refbuf->data;
+                client->ops = &http_req_source_ops;
+                break;
+            case httpp_req_stats:
+                refbuf->len = PER_CLIENT_REFBUF_SIZE;
+                client->ops = &http_req_stats_ops;
+                break;
+            default:
+                WARN1("unhandled request type from %s", client->connection.ip);
+                return client_send_501 (client);
+        }
+        client->counter = 0;
+        return client->ops->process(client);
+    }
+    /* invalid http request */
+    return -1;
+}
+
+
+/* The response to a kept alive request has been sent, so put the client back
+ * into the state of a new connection waiting for a request, using anything
+ * already read after the previous request. The client stays on its worker.
+ */
+int connection_keepalive (client_t *client)
+{
+    worker_t *worker = client->worker;
+    refbuf_t *r = client->pipelined;
+
+    if (client->respcode > 0 && client->parser)
+        logging_access (client);
+    if (client->parser)
+        httpp_destroy (client->parser);
+    client->parser = NULL;
+    if (client->free_client_data)
+        client->free_client_data (client);
+    client->free_client_data = NULL;
+    client->format_data = NULL;
+    free (client->username);
+    free (client->password);
+    client->username = NULL;
+    client->password = NULL;
+    refbuf_release (client->refbuf);
+    client->refbuf = NULL;
+
+    client->flags &= (CLIENT_ACTIVE|CLIENT_IP_BAN_LIFT);
+    client->respcode = 0;
+    client->pos = 0;
+    client->intro_offset = 0;
+    client->queue_pos = 0;
+    client->timer_start = 0;
+    client->mount = NULL;
+    client->check_buffer = NULL;
+    /* count what this pass has sent before the count restarts */
+    if (client->connection.sent_bytes > worker->sent_mark)
+        worker->bytes_sent += client->connection.sent_bytes - worker->sent_mark;
+    worker->sent_mark = 0;
+    client->connection.sent_bytes = 0;
+    client->connection.con_time = worker->current_time.tv_sec;
+    client->connection.discon_time = client->connection.con_time + keepalive_timeout;
+    client->counter = worker->time_ms;
+    client->ops = &http_request_ops;
+
+    client->pipelined = NULL;
+    if (r == NULL)
+    {
+        r = refbuf_new (PER_CLIENT_REFBUF_SIZE);
+        r->len = 0;
+    }
+    client->shared_data = r;
+    /* do not process pipelined requests here, as that could recurse deeply */
+    client->schedule_ms = worker->time_ms + (r->len ? 0 : 6);
+    return 0;
+}
+
+
 static void *connection_thread (void *arg)
 {
     ice_config_t *config;
@@ -1077,18 +1548,19 @@ static void *connection_thread (void *arg)
     sigaddset(&mask, SIGTERM);
     sigfd = signalfd(-1, &mask, 0);
 #endif
+    thread_mutex_lock (&_cache_lock);
     banned_ip.filename = NULL;
     banned_ip.file_mtime = 0;
-    banned_ip.add_new_entry = add_banned_ip;
-    banned_ip.compare = compare_banned_ip;
+    banned_ip.file_recheck = 0;
+    banned_ip.addresses = 1;
     allowed_ip.filename = NULL;
     allowed_ip.file_mtime = 0;
-    allowed_ip.add_new_entry = add_generic_text;
-    allowed_ip.compare = compare_pattern;
+    allowed_ip.file_recheck = 0;
+    allowed_ip.addresses = 1;
     useragents.filename = NULL;
     useragents.file_mtime = 0;
-    useragents.add_new_entry = add_generic_text;
-    useragents.compare = compare_pattern;
+    useragents.file_recheck = 0;
+    useragents.addresses = 0;
 
     connection_running = 1;
     INFO0 ("connection thread started");
@@ -1101,43 +1573,45 @@ static void *connection_thread (void *arg)
         allowed_ip.filename = strdup (config->allowfile);
     if (config->agentfile)
         useragents.filename = strdup (config->agentfile);
+    thread_mutex_unlock (&_cache_lock);
+    /* initial read, later checks are done by the slave thread */
+    connection_recheck_files (time (NULL));
 
     get_ssl_certificate (config);
     connection_setup_sockets (config);
+    /* already open when the sockets were set up before any change of user,
+     * else done here as on a restart the listening sockets are kept */
+    acceptors_open (config->acceptors_count);
     header_timeout = config->header_timeout;
+    keepalive_timeout = config->keepalive_timeout;
+    keepalive_requests = config->keepalive_requests;
     config_release_config ();
 
+    memset (&acceptors[0], 0, sizeof (acceptors[0]));
+    acceptors_start ();
+
     while (connection_running)
     {
-        client_t *client = accept_client ();
-        if (client)
-        {
-            /* do a small delay here so the client has chance to send the request after
-             * getting a connect. */
-            client->counter = client->schedule_ms = timing_get_time();
-            client->connection.con_time = client->schedule_ms/1000;
-            client->connection.discon_time = client->connection.con_time + header_timeout;
-            client->schedule_ms += 6;
-            client_add_worker (client);
-            stats_event_inc (NULL, "connections");
-        }
-        if (global.new_connections_slowdown)
-            thread_sleep (global.new_connections_slowdown * 5000);
+        int i = wait_for_serversock ();
+
+        if (i >= 0)
+            accept_pending (&acceptors[0], global.serversock [i], global.server_conn [i]);
     }
+    acceptors_stop ();
 #ifdef HAVE_OPENSSL
     SSL_CTX_free (ssl_ctx);
 #endif
-    global_lock();
-    if (banned_ip.contents)  avl_tree_free (banned_ip.contents, free_filtered_line);
-    if (allowed_ip.contents) avl_tree_free (allowed_ip.contents, free_filtered_line);
-    if (useragents.contents) avl_tree_free (useragents.contents, free_filtered_line);
+    thread_mutex_lock (&_cache_lock);
+    cache_publish (&banned_ip, NULL, NULL);
+    cache_publish (&allowed_ip, NULL, NULL);
+    cache_publish (&useragents, NULL, NULL);
     free (banned_ip.filename);
     free (allowed_ip.filename);
     free (useragents.filename);
     memset (&banned_ip, 0, sizeof (banned_ip));
     memset (&allowed_ip, 0, sizeof (allowed_ip));
     memset (&useragents, 0, sizeof (useragents));
-    global_unlock();
+    thread_mutex_unlock (&_cache_lock);
     connection_close_sigfd ();
 
     INFO0 ("connection thread finished");
@@ -1507,7 +1981,7 @@ static int _handle_get_request (client_t *client)
     }
     config_release_config();
 
-    stats_event_inc(NULL, "client_connections");
+    stats_counter_inc (STATS_CTR_CLIENT_CONNECTIONS);
 
     if (strcmp (uri, "/admin.cgi") == 0 || strncmp("/admin/", uri, 7) == 0)
         ret = admin_handle_request (client, uri);
@@ -1597,7 +2071,8 @@ int connection_setup_sockets (ice_config_t *config)
 
         do
         {
-            sock_t sock = sock_get_server_socket (listener->port, listener->bind_address);
+            sock_t sock = sock_get_server_socket (listener->port, listener->bind_address,
+                    config->acceptors_count > 1);
             if (sock == SOCK_ERROR)
                 break;
             if (sock_listen (sock, listener->qlen) == SOCK_ERROR)
@@ -1640,7 +2115,10 @@ int connection_setup_sockets (ice_config_t *config)
     global_unlock();
 
     if (count)
+    {
         INFO1 ("%d listening sockets setup complete", count);
+        acceptors_open (config->acceptors_count);
+    }
     else
         ERROR0 ("No listening sockets established");
     return count;
@@ -26,6 +26,7 @@
 
 struct source_tag;
 struct ice_config_tag;
+struct _client_tag;
 typedef struct connection_tag connection_t;
 
 #include "compat.h"
@@ -42,6 +43,9 @@ struct connection_tag
 
     sock_t sock;
     int error;
+    int write_blocked;  /* last send attempt would of blocked */
+    int read_idle;      /* idle between requests, waiting for the next to arrive */
+    int polled;         /* armed on the worker epoll set */
 
 #ifdef HAVE_OPENSSL
     SSL *ssl;   /* SSL handler */
@@ -56,6 +60,7 @@ struct connection_bufs
     short count, max;
     int total;
     IOVEC *block;
+    IOVEC *initial;     /* caller provided, eg on the stack, so not freed */
 };
 
 
@@ -74,13 +79,17 @@ int  connection_init (connection_t *con, sock_t sock, const char *addr);
 int  connection_complete_source (struct source_tag *source);
 void connection_uses_ssl (connection_t *con);
 void connection_add_banned_ip (const char *ip, int duration);
+void connection_recheck_files (time_t now);
 void connection_release_banned_ip (const char *ip);
 void connection_stats (void);
+int  connection_keepalive (struct _client_tag *client);
 
 void connection_bufs_init (struct connection_bufs *vectors, short start);
+void connection_bufs_init_on (struct connection_bufs *vectors, IOVEC *space, short count);
 void connection_bufs_release (struct connection_bufs *v);
 void connection_bufs_flush (struct connection_bufs *v);
 int  connection_bufs_append (struct connection_bufs *vectors, void *buf, unsigned int len);
+int  connection_bufs_copy (struct connection_bufs *vectors, void *dst);
 int  connection_bufs_read (connection_t *con, struct connection_bufs *vecs, int skip);
 int  connection_bufs_send (connection_t *con, struct connection_bufs *vecs, int skip);
 
@@ -69,7 +69,9 @@ void event_config_read (void)
         config = config_get_config();
         yp_recheck_config (config);
         fserve_recheck_mime_types (config);
+        fserve_recheck_cache (config);
         stats_global (config);
+        workers_config (config);
         workers_adjust (config->workers_count);
         connection_listen_sockets_close (config, 0);
         redirector_setup (config);
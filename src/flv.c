@@ -102,7 +102,7 @@ static int flv_mpX_hdr (struct mpeg_sync *mp, unsigned char *frame, unsigned int
     memcpy (mp->raw->data + mp->raw_offset, &flv->tag[0], 16);
     connection_bufs_append (&flv->bufs, mp->raw->data + mp->raw_offset, 16);
     flv->samples += mp->sample_count;
-    flv->prev_ms = (int64_t)((double)flv->samples / (mp->samplerate/1000.0));
+    flv->prev_ms = flv->base_ms + (int64_t)((double)flv->samples / (mp->samplerate/1000.0));
     // The extra byte is for the flv audio id, usually 0x2F 
     flv->prev_tagsize = (len + FLVHEADER + 1);
     mp->raw_offset += 16;
@@ -125,7 +125,7 @@ static int flv_aac_hdr (struct mpeg_sync *mp, unsigned char *frame, unsigned int
     memcpy (mp->raw->data + mp->raw_offset, &flv->tag[0], 17);
     connection_bufs_append (&flv->bufs, mp->raw->data + mp->raw_offset, 17);
     flv->samples += mp->sample_count;
-    flv->prev_ms = (int64_t)((double)flv->samples / (mp->samplerate/1000.0));
+    flv->prev_ms = flv->base_ms + (int64_t)((double)flv->samples / (mp->samplerate/1000.0));
     // frame length + FLVHEADER + AVHEADER
     flv->prev_tagsize = (len + 11 + 2);
     mp->raw_offset += 17;
@@ -259,10 +259,7 @@ int flv_write_metadata (struct flv *flv, refbuf_t *scmeta, const char *mount)
         if (meta_copied + 15 + flv->mpeg_sync.raw_offset > raw->len)
         {
             int newlen = meta_copied + flv->mpeg_sync.raw_offset + 1024;
-            void *p = realloc (raw->data, newlen);
-            if (p == NULL) return -1;
-            raw->data = p;
-            raw->len = newlen;
+            refbuf_expand (raw, newlen);
             flv->block_pos = flv->mpeg_sync.raw_offset = 0;
             connection_bufs_flush (&flv->bufs);
             return -1;
@@ -300,6 +297,101 @@ int flv_process_buffer (struct flv *flv, refbuf_t *refbuf)
 }
 
 
+static uint64_t flv_tag_ms (const unsigned char *p)
+{
+    return ((uint64_t)p[11] << 24) | (p[8] << 16) | (p[9] << 8) | p[10];
+}
+
+
+/* append a tag for the aac codes, needed by players before any frames */
+static void flv_write_codes (struct flv *flv, refbuf_t *codes)
+{
+    refbuf_t *raw = flv->mpeg_sync.raw;
+    char *dst = raw->data + flv->mpeg_sync.raw_offset;
+
+    flv_hdr (flv, codes->len);
+    memcpy (dst, &flv->tag[0], 15);
+    connection_bufs_append (&flv->bufs, dst, 15);
+    flv->mpeg_sync.raw_offset += 15;
+    connection_bufs_append (&flv->bufs, codes->data, codes->len);
+    flv->prev_tagsize = codes->len + FLVHEADER;
+}
+
+
+static void flv_set_tag_ms (unsigned char *p, uint64_t ms)
+{
+    p[10] = ms & 0xFF;
+    p[9] = (ms >> 8) & 0xFF;
+    p[8] = (ms >> 16) & 0xFF;
+    p[11] = (ms >> 24) & 0xFF;
+}
+
+
+/* Send a block already wrapped by the source. The tag contents are sent from
+ * the shared copy, but each tag header is copied so that the time can be made
+ * relative to when this listener joined the shared stream, along with any tags
+ * needed for joining the stream.
+ */
+static int send_flv_rendition (client_t *client, struct flv *flv)
+{
+    refbuf_t *ref = client->refbuf, *scmeta = ref->associated, *wrapped = ref->rendition;
+    int ret;
+
+    if (flv->bufs.total == 0)
+    {
+        unsigned char *p = (unsigned char *)wrapped->data, *end = p + wrapped->len;
+        refbuf_t *raw = flv->mpeg_sync.raw;
+        unsigned int needed = wrapped->len + 1024;
+
+        if (flv->shared == 0)
+        {
+            flv->shared = 1;
+            flv->shared_ms = flv_tag_ms (p);
+            flv->base_ms = flv->prev_ms;
+        }
+        /* a header for every tag at most doubles the size */
+        if (raw->len < needed)
+            refbuf_expand (raw, needed);
+        flv->prev_ms = flv->base_ms + flv_tag_ms (p) - flv->shared_ms;
+        flv->mpeg_sync.raw_offset = 0;
+        if (wrapped->associated && wrapped->associated != flv->seen_codes)
+            flv_write_codes (flv, wrapped->associated);
+        if (flv->seen_metadata != scmeta && p[4] != 18)
+            if (flv_write_metadata (flv, scmeta, client->mount) < 0)
+                return 0;
+        while (p + 4 + FLVHEADER <= end)
+        {
+            unsigned char *hdr = (unsigned char *)raw->data + flv->mpeg_sync.raw_offset;
+            int len = (p[5] << 16) | (p[6] << 8) | p[7];
+
+            if (p + 4 + FLVHEADER + len > end)
+                break;
+            hdr[0] = 0;
+            hdr[1] = (flv->prev_tagsize >> 16) & 0xFF;
+            hdr[2] = (flv->prev_tagsize >> 8) & 0xFF;
+            hdr[3] = flv->prev_tagsize & 0xFF;
+            memcpy (hdr + 4, p + 4, FLVHEADER);
+            flv->prev_ms = flv->base_ms + flv_tag_ms (p) - flv->shared_ms;
+            flv_set_tag_ms (hdr, flv->prev_ms);
+            connection_bufs_append (&flv->bufs, hdr, 4 + FLVHEADER);
+            connection_bufs_append (&flv->bufs, p + 4 + FLVHEADER, len);
+            flv->mpeg_sync.raw_offset += 4 + FLVHEADER;
+            flv->prev_tagsize = len + FLVHEADER;
+            p += 4 + FLVHEADER + len;
+        }
+    }
+    ret = send_flv_buffer (client, flv);
+    if (flv->bufs.total == 0)
+    {
+        flv->seen_metadata = scmeta;
+        flv->seen_codes = wrapped->associated;
+        client->pos = ref->len;
+        client->queue_pos += ref->len;
+    }
+    return ret;
+}
+
+
 int write_flv_buf_to_client (client_t *client) 
 {
     refbuf_t *ref = client->refbuf, *scmeta = ref->associated;
@@ -315,6 +407,18 @@ int write_flv_buf_to_client (client_t *client)
     if (client->pos == ref->len)
         return -1;
 
+    /* the shared stream is only joined from the start, as frame timing is
+     * only known while wrapping here */
+    if (ref->rendition && client->pos == 0 && (flv->shared || flv->prev_tagsize == 0))
+        return send_flv_rendition (client, flv);
+
+    if (flv->shared && flv->mpeg_sync.raw_offset == 0)
+    {
+        /* wrapping here from now on, carry on from the time of the last tag sent */
+        flv->base_ms = flv->prev_ms;
+        flv->samples = 0;
+        flv->shared = 0;
+    }
     /* check for metadata updates and insert if needed */
     if (flv->mpeg_sync.raw_offset == 0)
     {
@@ -341,6 +445,100 @@ int write_flv_buf_to_client (client_t *client)
 }
 
 
+/* Setup for wrapping the source blocks, the result is then shared by all
+ * flv listeners of the source.
+ */
+struct flv *flv_mux_create (format_plugin_t *plugin)
+{
+    struct flv *flv = calloc (1, sizeof (struct flv));
+
+    mpeg_setup (&flv->mpeg_sync, plugin->mount);
+    mpeg_check_numframes (&flv->mpeg_sync, 1);
+    flv->mpeg_sync.raw = refbuf_new (1024);
+    flv->mpeg_sync.callback_key = flv;
+    flv->tag[4] = 8;    // Audio details only
+    if (plugin->type == FORMAT_TYPE_AAC)
+    {
+        /* the codes are sent by each listener, so not in the wrapped stream */
+        flv->tag[15] = 0xAF;
+        flv->tag[16] = 0x01;
+        flv->mpeg_sync.frame_callback = flv_aac_hdr;
+    }
+    else
+    {
+        flv->tag[15] = 0x22;
+        flv->mpeg_sync.frame_callback = flv_mpX_hdr;
+    }
+    flv->seen_metadata = (void*)flv;
+    connection_bufs_init (&flv->bufs, 10);
+    return flv;
+}
+
+
+void flv_mux_free (struct flv *flv)
+{
+    if (flv == NULL)
+        return;
+    mpeg_cleanup (&flv->mpeg_sync);
+    connection_bufs_release (&flv->bufs);
+    refbuf_release (flv->codes);
+    free (flv);
+}
+
+
+/* Wrap a block of complete frames from the source, before it is put on the
+ * queue. The frames are checked in a copy as a resync may change the data, the
+ * source block is left as read. The wrapped copy is kept as the block rendition
+ * with any aac codes associated with it, metadata tags are added where the
+ * metadata changes.
+ */
+int flv_mux_block (struct flv *flv, refbuf_t *refbuf)
+{
+    refbuf_t *scmeta = refbuf->associated, *wrapped, *copy;
+    unsigned int needed = refbuf->len * 3 + 1024;
+    int ret;
+
+    /* worst case is a tag header for every few bytes */
+    if (flv->mpeg_sync.raw->len < needed)
+        refbuf_expand (flv->mpeg_sync.raw, needed);
+    flv->mpeg_sync.raw_offset = 0;
+    connection_bufs_flush (&flv->bufs);
+
+    if (flv->seen_metadata != scmeta)
+    {
+        if (flv_write_metadata (flv, scmeta, flv->mpeg_sync.mount) < 0 &&
+                flv_write_metadata (flv, scmeta, flv->mpeg_sync.mount) < 0)
+            return -1;
+        flv->seen_metadata = scmeta;
+    }
+    copy = refbuf_new (refbuf->len);
+    memcpy (copy->data, refbuf->data, refbuf->len);
+    ret = mpeg_complete_frames (&flv->mpeg_sync, copy, 0);
+    if (ret < 0 || flv->bufs.total == 0)
+    {
+        connection_bufs_flush (&flv->bufs);
+        refbuf_release (copy);
+        return -1;
+    }
+    if (flv->codes == NULL && flv->tag[15] == 0xAF && flv->mpeg_sync.samplerate)
+    {
+        flv->codes = refbuf_new (6);
+        flv->codes->data[0] = 0xAF;
+        flv->codes->data[1] = 0x0;
+        flv->codes->len = 2 + audio_specific_config (&flv->mpeg_sync, (unsigned char *)flv->codes->data + 2);
+    }
+    wrapped = refbuf_new (flv->bufs.total);
+    connection_bufs_copy (&flv->bufs, wrapped->data);
+    refbuf_release (copy);
+    wrapped->associated = flv->codes;
+    refbuf_addref (flv->codes);
+    refbuf->rendition = wrapped;
+    flv->mpeg_sync.raw_offset = 0;
+    connection_bufs_flush (&flv->bufs);
+    return 0;
+}
+
+
 void flv_write_BE64 (void *where, void *val)
 {
     int len = sizeof (uint64_t);
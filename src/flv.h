@@ -21,9 +21,14 @@ struct flv
 {
     int prev_tagsize;
     int block_pos;
+    int shared;
     uint64_t prev_ms;
+    uint64_t base_ms;
+    uint64_t shared_ms;     /* time in the shared stream when this listener joined it */
     int64_t samples;
     refbuf_t *seen_metadata;
+    refbuf_t *seen_codes;
+    refbuf_t *codes;        /* aac codes, when wrapping for the source */
     mpeg_sync mpeg_sync;
     struct connection_bufs bufs;
     unsigned char tag[30];
@@ -35,6 +40,10 @@ void flv_create_client_data (format_plugin_t *plugin, client_t *client);
 void free_flv_client_data (client_t *client);
 int  flv_process_buffer (struct flv *flv, refbuf_t *refbuf);
 
+struct flv *flv_mux_create (format_plugin_t *plugin);
+void flv_mux_free (struct flv *flv);
+int  flv_mux_block (struct flv *flv, refbuf_t *refbuf);
+
 refbuf_t *flv_meta_allocate (size_t len);
 void flv_meta_append_string (refbuf_t *buffer, const char *tag, const char *value);
 void flv_meta_append_number (refbuf_t *buffer, const char *tag, double value);
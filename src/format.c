@@ -45,6 +45,9 @@
 #include "stats.h"
 #define CATMODULE "format"
 
+/* most vectors used in a send over queue blocks */
+#define FORMAT_SEND_VECTORS     32
+
 
 format_type_t format_get_type(const char *content_type)
 {
@@ -119,6 +122,15 @@ int format_get_plugin (format_plugin_t *plugin, client_t *client)
 
 
 int format_file_read (client_t *client, format_plugin_t *plugin, icefile_handle f)
+{
+    return format_file_read_via (client, plugin, f, NULL, NULL);
+}
+
+
+/* as format_file_read, but the data is got by calling reader instead of
+ * reading the file directly, eg to get it from a cache */
+int format_file_read_via (client_t *client, format_plugin_t *plugin, icefile_handle f,
+        format_read_func reader, void *arg)
 {
     refbuf_t *refbuf = client->refbuf;
     ssize_t bytes = -1;
@@ -151,7 +163,10 @@ int format_file_read (client_t *client, format_plugin_t *plugin, icefile_handle
 
         if (file_in_use (f) == 0) return -2;
 
-        bytes = pread (f, refbuf->data, 8192, client->intro_offset);
+        if (reader)
+            bytes = reader (arg, refbuf->data, 8192, client->intro_offset);
+        else
+            bytes = pread (f, refbuf->data, 8192, client->intro_offset);
         if (bytes <= 0)
             return bytes < 0 ? -2 : -1;
 
@@ -171,6 +186,66 @@ int format_file_read (client_t *client, format_plugin_t *plugin, icefile_handle
 }
 
 
+/* Send from the listener position over the following queue blocks in the one
+ * writev, up to limit bytes. Blocks are only joined while they have the same
+ * associated block, as a change may need something sent first. The client
+ * block and position are moved on to match what was sent.
+ */
+int format_send_queue_blocks (client_t *client, unsigned int limit)
+{
+    refbuf_t *refbuf = client->refbuf;
+    unsigned int pos = client->pos;
+    struct { refbuf_t *refbuf; int len; } parts [FORMAT_SEND_VECTORS];
+    IOVEC space [FORMAT_SEND_VECTORS];
+    struct connection_bufs bufs;
+    int ret, i, remaining;
+
+    connection_bufs_init_on (&bufs, space, FORMAT_SEND_VECTORS);
+    while (bufs.count < FORMAT_SEND_VECTORS)
+    {
+        refbuf_t *next = refbuf->next;
+
+        if (refbuf->len > pos)
+        {
+            parts [bufs.count].refbuf = refbuf;
+            parts [bufs.count].len = refbuf->len - pos;
+            connection_bufs_append (&bufs, refbuf->data + pos, refbuf->len - pos);
+        }
+        if (bufs.total >= limit || (refbuf->flags & SOURCE_QUEUE_BLOCK) == 0)
+            break;
+        if (next == NULL || next->associated != refbuf->associated)
+            break;
+        refbuf = next;
+        pos = 0;
+    }
+    if (bufs.count == 0)
+        return -1;
+
+    ret = connection_bufs_send (&client->connection, &bufs, 0);
+    if (ret < bufs.total)
+        client->schedule_ms += 50;
+
+    remaining = ret;
+    for (i = 0; i < bufs.count && remaining > 0; i++)
+    {
+        int sent = remaining < parts[i].len ? remaining : parts[i].len;
+
+        if (parts[i].refbuf != client->refbuf)
+        {
+            /* the previous block has been completed */
+            client->refbuf = parts[i].refbuf;
+            client->pos = 0;
+        }
+        client->pos += sent;
+        client->queue_pos += sent;
+        client->counter += sent;
+        remaining -= sent;
+    }
+    connection_bufs_release (&bufs);
+    return ret;
+}
+
+
 int format_generic_write_to_client (client_t *client)
 {
     refbuf_t *refbuf = client->refbuf;
@@ -196,7 +271,6 @@ int format_general_headers (format_plugin_t *plugin, client_t *client)
     char *ptr = client->refbuf->data + client->refbuf->len;
     int bytes;
     int bitrate_filtered = 0;
-    avl_node *node;
     ice_config_t *config;
 
     if (client->respcode == 0)
@@ -270,13 +344,15 @@ int format_general_headers (format_plugin_t *plugin, client_t *client)
 
     if (plugin->parser)
     {
+        httpp_walk_t walk;
+        http_var_t *var;
+
         /* iterate through source http headers and send to client */
-        avl_tree_rlock (plugin->parser->vars);
-        node = avl_get_first (plugin->parser->vars);
-        while (node)
+        httpp_walk_start (plugin->parser, &walk);
+        var = httpp_walk_next (&walk);
+        while (var)
         {
             int next = 1;
-            http_var_t *var = (http_var_t *)node->key;
             bytes = 0;
             if (!strcasecmp (var->name, "ice-audio-info"))
             {
@@ -324,9 +400,9 @@ int format_general_headers (format_plugin_t *plugin, client_t *client)
             remaining -= bytes;
             ptr += bytes;
             if (next)
-                node = avl_get_next (node);
+                var = httpp_walk_next (&walk);
         }
-        avl_tree_unlock (plugin->parser->vars);
+        httpp_walk_end (&walk);
     }
 
     config = config_get_config();
@@ -68,8 +68,13 @@ struct _format_plugin_tag
 format_type_t format_get_type(const char *contenttype);
 int format_get_plugin (format_plugin_t *plugin, client_t *client);
 int format_generic_write_to_client (client_t *client);
+int format_send_queue_blocks (client_t *client, unsigned int limit);
+
+typedef ssize_t (*format_read_func)(void *arg, void *data, size_t count, off_t offset);
 
 int format_file_read (client_t *client, format_plugin_t *plugin, icefile_handle f);
+int format_file_read_via (client_t *client, format_plugin_t *plugin, icefile_handle f,
+        format_read_func reader, void *arg);
 int format_general_headers (format_plugin_t *plugin, client_t *client);
 
 void format_send_general_headers(format_plugin_t *format, 
@@ -147,6 +147,11 @@ static int ebml_write_buf_to_client (client_t *client)
     {
         return send_ebml_header (client);
     }
+    else if (client->refbuf->flags & SOURCE_QUEUE_BLOCK)
+    {
+        source_t *source = client->shared_data;
+        return format_send_queue_blocks (client, source->listener_send_trigger);
+    }
     else
     {
         return format_generic_write_to_client(client);
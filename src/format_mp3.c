@@ -50,6 +50,10 @@
  */
 #define ICY_METADATA_INTERVAL 16000
 
+/* limits for a single send to a listener */
+#define MP3_SEND_VECTORS    64
+#define MP3_SEND_LIMIT      65536
+
 static void format_mp3_free_plugin(format_plugin_t *plugin, client_t *client);
 static refbuf_t *mp3_get_filter_meta (source_t *source);
 static refbuf_t *mp3_get_no_meta (source_t *source);
@@ -429,121 +433,134 @@ static void mp3_set_title (source_t *source)
 }
 
 
-/* send the appropriate metadata, and return the number of bytes written
- * which is 0 or greater.  Check the client in_metadata value afterwards
- * to see if all metadata has been sent
- */
-static int send_icy_metadata (client_t *client, refbuf_t *refbuf)
+/* pick the metadata to send at an interval point in the block, a change is
+ * sent in full else a single zero byte is sent in its place */
+static refbuf_t *mp3_pick_metadata (refbuf_t *refbuf, refbuf_t *seen, char **data, int *len)
 {
-    int ret = 0;
-    char *metadata;
-    int meta_len, block_len;
     refbuf_t *associated = refbuf->associated;
-    mp3_client_data *client_mp3 = client->format_data;
-    struct connection_bufs bufs;
 
-    /* If there is a change in metadata then send it else
-     * send a single zero value byte in its place
-     */
-    if (client->flags & CLIENT_IN_METADATA)
+    if (associated && associated != seen)
     {
-        /* rare but possible case of resuming a send part way through a metadata block */
-        metadata = client_mp3->associated->data + client_mp3->metadata_offset;
-        meta_len = client_mp3->associated->len - client_mp3->metadata_offset;
+        /* change of metadata found, but we do not release the blank one as that
+         * could race against the source client use of it. */
+        *data = associated->data;
+        *len = associated->len;
+        return associated;
     }
-    else
+    if (associated)
     {
-        if (associated && associated != client_mp3->associated)
-        {
-            /* change of metadata found, but we do not release the blank one as that
-             * could race against the source client use of it. */
-            metadata = associated->data;
-            meta_len = associated->len;
-            client_mp3->associated = associated;
-        }
-        else
-        {
-            /* previously sent metadata does not need to be sent again */
-            if (associated)
-            {
-                metadata = "\0";
-                meta_len = 1;
-            }
-            else
-            {
-                char *meta = blank_meta.data;
-                metadata = meta + client_mp3->metadata_offset;
-                meta_len = blank_meta.len - client_mp3->metadata_offset;
-                client_mp3->associated = &blank_meta;
-            }
-        }
+        /* previously sent metadata does not need to be sent again */
+        *data = "\0";
+        *len = 1;
+        return seen;
     }
-    block_len = refbuf->len - client->pos;
-
-    if (block_len > client_mp3->interval)
-        block_len = client_mp3->interval; // handle small intervals
-
-    connection_bufs_init (&bufs, 2);
-    connection_bufs_append (&bufs, metadata, meta_len);
-    connection_bufs_append (&bufs, refbuf->data + client->pos, block_len);
-    ret = connection_bufs_send (&client->connection, &bufs, 0);
-    connection_bufs_release (&bufs);
-
-    if (ret >= meta_len)
-    {
-        int queue_bytes = ret - meta_len;
-        client->queue_pos += queue_bytes;
-        client->counter += queue_bytes;
-        client_mp3->since_meta_block = queue_bytes;
-        client->pos += queue_bytes;
-        client->flags &= ~CLIENT_IN_METADATA;
-        client_mp3->metadata_offset = 0;
-    }
-    else
-    {
-        client->flags |= CLIENT_IN_METADATA;
-        if (ret > 0)
-            client_mp3->metadata_offset += ret;
-        client->schedule_ms += 150;
-    }
-    return ret;
+    *data = blank_meta.data;
+    *len = blank_meta.len;
+    return &blank_meta;
 }
 
 
 /* Handler for writing mp3 data to a client, taking into account whether
- * client has requested shoutcast style metadata updates
+ * client has requested shoutcast style metadata updates. The send covers
+ * as much of the queue as is ready, up to a limit, with the metadata
+ * blocks placed in between at each interval, so it is one writev. The
+ * vectors are on the stack to avoid allocating for every send.
  */
 static int format_mp3_write_buf_to_client (client_t *client) 
 {
-    int ret = -1, len;
     mp3_client_data *client_mp3 = client->format_data;
-    refbuf_t *refbuf = client->refbuf;
+    refbuf_t *refbuf = client->refbuf, *seen = client_mp3->associated;
+    unsigned int pos = client->pos, since = client_mp3->since_meta_block, interval = client_mp3->interval;
+    struct { refbuf_t *refbuf, *meta; int len; } parts [MP3_SEND_VECTORS];
+    IOVEC space [MP3_SEND_VECTORS];
+    struct connection_bufs bufs;
+    int ret, i, remaining;
+
+    connection_bufs_init_on (&bufs, space, MP3_SEND_VECTORS);
+    if (client->flags & CLIENT_IN_METADATA)
+    {
+        /* rare but possible case of resuming a send part way through a metadata block */
+        parts[0].refbuf = NULL;
+        parts[0].meta = seen;
+        parts[0].len = seen->len - client_mp3->metadata_offset;
+        connection_bufs_append (&bufs, seen->data + client_mp3->metadata_offset,
+                seen->len - client_mp3->metadata_offset);
+        since = 0;
+    }
+    while (bufs.count < MP3_SEND_VECTORS && bufs.total < MP3_SEND_LIMIT)
+    {
+        unsigned int len = refbuf->len - pos;
 
-    if (client_mp3->interval && client_mp3->interval == client_mp3->since_meta_block)
-        return send_icy_metadata (client, refbuf);
+        if (len == 0)
+        {
+            /* only queue blocks are linked to later data */
+            if ((refbuf->flags & SOURCE_QUEUE_BLOCK) == 0 || refbuf->next == NULL)
+                break;
+            refbuf = refbuf->next;
+            pos = 0;
+            continue;
+        }
+        if (interval && since == interval)
+        {
+            char *data;
+            int meta_len;
+
+            parts [bufs.count].refbuf = NULL;
+            seen = parts [bufs.count].meta = mp3_pick_metadata (refbuf, seen, &data, &meta_len);
+            parts [bufs.count].len = meta_len;
+            connection_bufs_append (&bufs, data, meta_len);
+            since = 0;
+            continue;
+        }
+        if (interval && len > interval - since)
+            len = interval - since;
+        parts [bufs.count].refbuf = refbuf;
+        parts [bufs.count].len = len;
+        connection_bufs_append (&bufs, refbuf->data + pos, len);
+        pos += len;
+        since += len;
+    }
+    if (bufs.count == 0)
+        return -1;
 
-    len = refbuf->len - client->pos;
-    if (client_mp3->interval && len > client_mp3->interval - client_mp3->since_meta_block)
-        len = client_mp3->interval - client_mp3->since_meta_block;
-    if (len > 2900)
-        len = 2900; // do not send a huge amount out in one go
+    ret = connection_bufs_send (&client->connection, &bufs, 0);
+    if (ret < bufs.total)
+        client->schedule_ms += (ret < 0) ? 150 : 50;
 
-    if (len)
+    /* account for what was sent, following the parts */
+    remaining = ret;
+    for (i = 0; i < bufs.count && remaining > 0; i++)
     {
-        char *buf = refbuf->data + client->pos;
+        int sent = remaining < parts[i].len ? remaining : parts[i].len;
 
-        ret = client_send_bytes (client, buf, len);
-
-        if (ret < len)
-            client->schedule_ms += (ret < 0) ? 150 : 50;
-        if (ret > 0)
+        remaining -= sent;
+        if (parts[i].refbuf == NULL)
         {
-            client_mp3->since_meta_block += ret;
-            client->pos += ret;
-            client->queue_pos += ret;
-            client->counter += ret;
+            client_mp3->associated = parts[i].meta;
+            if (sent < parts[i].len)
+            {
+                client->flags |= CLIENT_IN_METADATA;
+                client_mp3->metadata_offset += sent;
+                client->schedule_ms += 100;
+                break;
+            }
+            client->flags &= ~CLIENT_IN_METADATA;
+            client_mp3->metadata_offset = 0;
+            client_mp3->since_meta_block = 0;
+            continue;
+        }
+        if (parts[i].refbuf != client->refbuf)
+        {
+            /* the previous block has been completed */
+            client->refbuf = parts[i].refbuf;
+            client->pos = 0;
         }
+        client->pos += sent;
+        client->queue_pos += sent;
+        client->counter += sent;
+        client_mp3->since_meta_block += sent;
     }
+    connection_bufs_release (&bufs);
     return ret;
 }
 
@@ -554,9 +571,10 @@ static int send_iceblock_to_client (client_t *client)
     mp3_client_data *client_mpg = client->format_data;
     refbuf_t *refbuf = client->refbuf;
     unsigned char lengthbytes[2];
+    IOVEC space [3];
     struct connection_bufs v;
 
-    connection_bufs_init (&v, 2);
+    connection_bufs_init_on (&v, space, 3);
     if (refbuf->associated != client_mpg->associated)
     {
         refbuf_t *meta = refbuf->associated;
@@ -621,6 +639,7 @@ static void format_mp3_free_plugin (format_plugin_t *plugin, client_t *client)
     free (format_mp3->url);
     refbuf_release (format_mp3->metadata);
     refbuf_release (format_mp3->read_data);
+    flv_mux_free (format_mp3->flv_mux);
     free (plugin->contenttype);
     free (format_mp3);
 }
@@ -743,6 +762,37 @@ static int validate_mpeg (source_t *source, refbuf_t *refbuf)
 }
 
 
+/* wrap the block for flv listeners here, so that it is done once for all of them */
+static void mp3_wrap_flv (source_t *source, refbuf_t *refbuf)
+{
+    mp3_state *source_mp3 = source->format->_state;
+    time_t now = source->client->worker->current_time.tv_sec;
+
+    if (source_mp3->flv_wanted == 0 || source->client->format_data == NULL)
+        return;
+    if (now >= source_mp3->flv_check)
+    {
+        /* stop wrapping once there are no flv listeners left */
+        avl_node *node = avl_get_first (source->clients);
+
+        while (node && (((client_t *)node->key)->flags & CLIENT_WANTS_FLV) == 0)
+            node = avl_get_next (node);
+        source_mp3->flv_check = now + 10;
+        if (node == NULL)
+        {
+            DEBUG1 ("no flv listeners left on %s", source->mount);
+            flv_mux_free (source_mp3->flv_mux);
+            source_mp3->flv_mux = NULL;
+            source_mp3->flv_wanted = 0;
+            return;
+        }
+    }
+    if (source_mp3->flv_mux == NULL)
+        source_mp3->flv_mux = flv_mux_create (source->format);
+    flv_mux_block (source_mp3->flv_mux, refbuf);
+}
+
+
 /* read an mp3 stream which does not have shoutcast style metadata */
 static refbuf_t *mp3_get_no_meta (source_t *source)
 {
@@ -767,6 +817,7 @@ static refbuf_t *mp3_get_no_meta (source_t *source)
     refbuf->associated = source_mp3->metadata;
     refbuf_addref (source_mp3->metadata);
     refbuf->flags |= SOURCE_BLOCK_SYNC;
+    mp3_wrap_flv (source, refbuf);
     return refbuf;
 }
 
@@ -872,6 +923,7 @@ static refbuf_t *mp3_get_filter_meta (source_t *source)
     refbuf->associated = source_mp3->metadata;
     refbuf_addref (source_mp3->metadata);
     refbuf->flags |= SOURCE_BLOCK_SYNC;
+    mp3_wrap_flv (source, refbuf);
 
     return refbuf;
 }
@@ -891,6 +943,7 @@ static int format_mp3_create_client_data (format_plugin_t *plugin, client_t *cli
     if (client->flags & CLIENT_WANTS_FLV)
     {
         flv_create_client_data (plugin, client); // special case
+        source_mp3->flv_wanted = 1;
         return 0;
     }
     client->free_client_data = free_mp3_client_data;
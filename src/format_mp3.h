@@ -50,6 +50,11 @@ typedef struct {
     refbuf_t *read_data;
     int read_count;
 
+    /* blocks are wrapped for flv listeners once one has been seen */
+    int flv_wanted;
+    time_t flv_check;
+    struct flv *flv_mux;
+
     unsigned build_metadata_len;
     unsigned build_metadata_offset;
     char build_metadata[4081];
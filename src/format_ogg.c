@@ -569,8 +569,6 @@ static int send_ogg_headers (client_t *client, refbuf_t *headers)
 static int write_buf_to_client (client_t *client)
 {
     refbuf_t *refbuf = client->refbuf;
-    char *buf = refbuf->data + client->pos;
-    unsigned len = refbuf->len - client->pos;
     struct ogg_client *client_data = client->format_data;
     int ret, written = 0;
 
@@ -584,18 +582,30 @@ static int write_buf_to_client (client_t *client)
             if (client_data->headers_sent == 0)
                 break;
         }
-        ret = client_send_bytes (client, buf, len);
-
-        if (ret > 0)
+        if (refbuf->flags & SOURCE_QUEUE_BLOCK)
         {
-            client->pos += ret;
-            client->queue_pos += ret;
-            written += ret;
-            client->counter += ret;
+            /* pages with the same headers can go out together */
+            source_t *source = client->shared_data;
+            ret = format_send_queue_blocks (client, source->listener_send_trigger);
+            if (ret > 0)
+                written += ret;
         }
+        else
+        {
+            char *buf = refbuf->data + client->pos;
+            unsigned len = refbuf->len - client->pos;
 
-        if (ret < (int)len)
-            client->schedule_ms += 50;
+            ret = client_send_bytes (client, buf, len);
+            if (ret > 0)
+            {
+                client->pos += ret;
+                client->queue_pos += ret;
+                written += ret;
+                client->counter += ret;
+            }
+            if (ret < (int)len)
+                client->schedule_ms += 50;
+        }
     } while (0);
 
     return written ? written : -1;
@@ -30,6 +30,9 @@
 #ifdef HAVE_POLL
 #include <sys/poll.h>
 #endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 
 #ifdef _MSC_VER
 #include <winsock2.h>
@@ -85,13 +88,31 @@ static avl_tree *fh_cache = NULL;
 #ifndef HAVE_PREAD
 static mutex_t seekread_lock;
 #endif
+static uint64_t fserve_sendfile_bytes, fserve_copied_bytes;
 
 typedef struct {
     char *ext;
     char *type;
 } mime_type;
 
-typedef struct {
+typedef struct fh_node_tag fh_node;
+
+/* file contents are cached in blocks shared by all clients of the file, the
+ * least recently used going first when over the memory limit */
+#define FH_BLOCK_SIZE           8192
+#define FH_BLOCK_MAX            (1<<20)
+#define FSERVE_CACHE_BLOCK      02000
+
+typedef struct fh_block
+{
+    refbuf_t *refbuf;
+    fh_node *fh;
+    unsigned int index;
+    struct fh_block *prev, *next;
+} fh_block;
+
+struct fh_node_tag
+{
     fbinfo finfo;
     mutex_t lock;
     int refcount;
@@ -103,7 +124,18 @@ typedef struct {
     format_plugin_t *format;
     struct rate_calc *out_bitrate;
     avl_tree *clients;
-} fh_node;
+
+    /* cached blocks, protected by fh_block_lock */
+    fh_block **blocks;
+    unsigned int blocks_alloc;
+    uint64_t cache_hits, cache_misses;
+    uint64_t cache_resident;
+};
+
+static mutex_t fh_block_lock;
+static fh_block *fh_block_head, *fh_block_tail;
+static uint64_t fh_block_resident, fh_block_limit;
+static uint64_t fh_block_hits, fh_block_misses;
 
 int fserve_running;
 
@@ -112,6 +144,7 @@ static int prefile_send (client_t *client);
 static int file_send (client_t *client);
 static int _compare_fh(void *arg, void *a, void *b);
 static int _delete_fh (void *mapping);
+static void _free_fserve_buffers (client_t *client);
 
 void fserve_initialize(void)
 {
@@ -123,8 +156,10 @@ void fserve_initialize(void)
     thread_mutex_create (&seekread_lock);
 #endif
     fh_cache = avl_tree_new (_compare_fh, NULL);
+    thread_mutex_create (&fh_block_lock);
 
     fserve_recheck_mime_types (config);
+    fserve_recheck_cache (config);
     config_release_config();
 
     stats_event_flags (NULL, "file_connections", "0", STATS_COUNTERS);
@@ -153,6 +188,7 @@ void fserve_shutdown(void)
 #ifndef HAVE_PREAD
     thread_mutex_destroy (&seekread_lock);
 #endif
+    thread_mutex_destroy (&fh_block_lock);
     INFO0("file serving stopped");
 }
 
@@ -217,6 +253,220 @@ static int _compare_fh(void *arg, void *a, void *b)
 }
 
 
+/* fh_block_lock must be held */
+static void fh_block_unlink (fh_block *block)
+{
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        fh_block_head = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
+    else
+        fh_block_tail = block->prev;
+    block->prev = block->next = NULL;
+}
+
+
+/* fh_block_lock must be held. Clients still sending the block keep their
+ * reference to it */
+static void fh_block_drop (fh_block *block)
+{
+    fh_node *fh = block->fh;
+
+    fh_block_unlink (block);
+    fh->blocks [block->index] = NULL;
+    fh->cache_resident -= FH_BLOCK_SIZE;
+    fh_block_resident -= FH_BLOCK_SIZE;
+    refbuf_release (block->refbuf);
+    free (block);
+}
+
+
+static void fh_block_evict (void)
+{
+    while (fh_block_resident > fh_block_limit && fh_block_tail)
+        fh_block_drop (fh_block_tail);
+}
+
+
+static void fh_blocks_free (fh_node *fh)
+{
+    unsigned int i;
+
+    if (fh->blocks == NULL)
+        return;
+    thread_mutex_lock (&fh_block_lock);
+    for (i = 0; i < fh->blocks_alloc; i++)
+        if (fh->blocks [i])
+            fh_block_drop (fh->blocks [i]);
+    thread_mutex_unlock (&fh_block_lock);
+    free (fh->blocks);
+    fh->blocks = NULL;
+}
+
+
+/* return a reference to the cached block of the file covering offset, reading
+ * it in if needed. Blocks not full, ie at the end of file, are not kept as the
+ * file may grow. NULL is returned at end of file or on error
+ */
+static refbuf_t *fh_block_get (fh_node *fh, off_t offset)
+{
+    unsigned int index = (unsigned int)(offset / FH_BLOCK_SIZE);
+    refbuf_t *refbuf;
+    fh_block *block;
+    ssize_t bytes;
+
+    if (file_in_use (fh->f) == 0)
+        return NULL;
+    if (fh_block_limit && index < FH_BLOCK_MAX)
+    {
+        thread_mutex_lock (&fh_block_lock);
+        if (index < fh->blocks_alloc && (block = fh->blocks [index]))
+        {
+            if (block != fh_block_head)
+            {
+                fh_block_unlink (block);
+                block->next = fh_block_head;
+                fh_block_head->prev = block;
+                fh_block_head = block;
+            }
+            fh->cache_hits++;
+            fh_block_hits++;
+            refbuf_addref (block->refbuf);
+            thread_mutex_unlock (&fh_block_lock);
+            return block->refbuf;
+        }
+        fh->cache_misses++;
+        fh_block_misses++;
+        thread_mutex_unlock (&fh_block_lock);
+    }
+    refbuf = refbuf_new (FH_BLOCK_SIZE);
+    refbuf->flags |= FSERVE_CACHE_BLOCK;
+    bytes = pread (fh->f, refbuf->data, FH_BLOCK_SIZE, (off_t)index * FH_BLOCK_SIZE);
+    if (bytes <= 0)
+    {
+        refbuf_release (refbuf);
+        return NULL;
+    }
+    refbuf->len = bytes;
+    if (bytes < FH_BLOCK_SIZE || fh_block_limit == 0 || index >= FH_BLOCK_MAX)
+        return refbuf;
+
+    thread_mutex_lock (&fh_block_lock);
+    if (index >= fh->blocks_alloc)
+    {
+        unsigned int len = (index + 64) & ~63;
+        fh_block **blocks = realloc (fh->blocks, len * sizeof (fh_block *));
+
+        if (blocks == NULL)
+        {
+            thread_mutex_unlock (&fh_block_lock);
+            return refbuf;
+        }
+        memset (blocks + fh->blocks_alloc, 0, (len - fh->blocks_alloc) * sizeof (fh_block *));
+        fh->blocks = blocks;
+        fh->blocks_alloc = len;
+    }
+    if (fh->blocks [index] == NULL) // may of been read in by another client
+    {
+        block = calloc (1, sizeof (fh_block));
+        block->refbuf = refbuf;
+        block->fh = fh;
+        block->index = index;
+        block->next = fh_block_head;
+        if (fh_block_head)
+            fh_block_head->prev = block;
+        else
+            fh_block_tail = block;
+        fh_block_head = block;
+        fh->blocks [index] = block;
+        fh->cache_resident += FH_BLOCK_SIZE;
+        fh_block_resident += FH_BLOCK_SIZE;
+        refbuf_addref (refbuf);
+        fh_block_evict ();
+    }
+    thread_mutex_unlock (&fh_block_lock);
+    return refbuf;
+}
+
+
+/* format_read_func for reading a file via the block cache, like pread this
+ * only returns short at the end of file */
+static ssize_t fh_block_read (void *arg, void *data, size_t count, off_t offset)
+{
+    fh_node *fh = arg;
+    ssize_t bytes = 0;
+
+    while ((size_t)bytes < count)
+    {
+        refbuf_t *refbuf = fh_block_get (fh, offset + bytes);
+        unsigned int pos = (unsigned int)((offset + bytes) % FH_BLOCK_SIZE), len = 0;
+
+        if (refbuf == NULL)
+            break;
+        if (refbuf->len > pos)
+        {
+            len = refbuf->len - pos;
+            if (len > count - bytes)
+                len = count - bytes;
+            memcpy ((char *)data + bytes, refbuf->data + pos, len);
+            bytes += len;
+        }
+        refbuf_release (refbuf);
+        if (len == 0 || (pos + len < FH_BLOCK_SIZE && (size_t)bytes < count))
+            break; // end of file
+    }
+    return bytes;
+}
+
+
+/* plain content is sent straight from the shared cache blocks. Returns the
+ * bytes sent, 0 at end of file, -1 if the socket is full and -2 on error */
+static int fh_block_send (client_t *client, fh_node *fh)
+{
+    refbuf_t *refbuf = client->refbuf;
+
+    if (refbuf == NULL || client->pos >= refbuf->len)
+    {
+        refbuf_t *block = fh_block_get (fh, client->intro_offset);
+
+        if (block == NULL)
+            return file_in_use (fh->f) ? 0 : -2;
+        _free_fserve_buffers (client);
+        client->refbuf = block;
+        client->pos = (unsigned int)(client->intro_offset % FH_BLOCK_SIZE);
+        if (client->pos >= block->len)
+        {
+            client->pos = block->len;
+            return 0;
+        }
+        client->intro_offset += block->len - client->pos;
+    }
+    return format_generic_write_to_client (client);
+}
+
+
+/* read into the clients own buffer, from the cache if possible */
+static int fh_file_read (client_t *client, fh_node *fh)
+{
+    if (client->refbuf && (client->refbuf->flags & FSERVE_CACHE_BLOCK))
+        _free_fserve_buffers (client);
+    if (fh_block_limit)
+        return format_file_read_via (client, fh->format, fh->f, fh_block_read, fh);
+    return format_file_read (client, fh->format, fh->f);
+}
+
+
+void fserve_recheck_cache (ice_config_t *config)
+{
+    thread_mutex_lock (&fh_block_lock);
+    fh_block_limit = config->file_cache_size;
+    fh_block_evict ();
+    thread_mutex_unlock (&fh_block_lock);
+}
+
+
 static int _delete_fh (void *mapping)
 {
     fh_node *fh = mapping;
@@ -225,6 +475,7 @@ static int _delete_fh (void *mapping)
     else
         thread_mutex_destroy (&fh->lock);
 
+    fh_blocks_free (fh);
     file_close (&fh->f);
     if (fh->format)
     {
@@ -401,6 +652,9 @@ static fh_node *open_fh (fbinfo *finfo)
         fh->stats = stats_handle (str);
         stats_set_flags (fh->stats, "fallback", "file", STATS_COUNTERS|STATS_HIDDEN);
         stats_set_flags (fh->stats, "outgoing_kbitrate", "0", STATS_COUNTERS|STATS_HIDDEN);
+        stats_set_flags (fh->stats, "cache_hits", "0", STATS_COUNTERS|STATS_HIDDEN);
+        stats_set_flags (fh->stats, "cache_misses", "0", STATS_COUNTERS|STATS_HIDDEN);
+        stats_set_flags (fh->stats, "cache_resident", "0", STATS_COUNTERS|STATS_HIDDEN);
         stats_set_flags (fh->stats, "listeners", "1", STATS_GENERAL|STATS_HIDDEN);
         stats_set_flags (fh->stats, "listener_peak", "1", STATS_GENERAL|STATS_HIDDEN);
         stats_release (fh->stats);
@@ -643,7 +897,7 @@ int fserve_client_create (client_t *httpclient, const char *path)
     finfo.fallback = NULL;
     finfo.limit = 0;
     finfo.type = FORMAT_TYPE_UNDEFINED;
-    stats_event_inc (NULL, "file_connections");
+    stats_counter_inc (STATS_CTR_FILE_CONNECTIONS);
 
     return fserve_setup_client_fb (httpclient, &finfo);
 }
@@ -694,7 +948,7 @@ static void file_release (client_t *client)
     {
         thread_mutex_lock (&fh->lock);
         if (fh->finfo.flags & FS_FALLBACK)
-            stats_event_dec (NULL, "listeners");
+            stats_counter_dec (STATS_CTR_LISTENERS);
         remove_from_fh (fh, client);
         fh_release (fh);
     }
@@ -771,7 +1025,7 @@ static int fserve_change_worker (client_t *client)
     worker = worker_selected ();
     if (worker && worker != client->worker)
     {
-        long diff = this_worker->count - worker->count;
+        long diff = worker_load (this_worker) - worker_load (worker);
         if (diff > 15)
         {
             this_worker->move_allocations--;
@@ -785,6 +1039,117 @@ static int fserve_change_worker (client_t *client)
 }
 
 
+/* is the file content sent as is, without metadata inserted or wrapping */
+static int fserve_plain_content (client_t *client, fh_node *fh)
+{
+    if (client->check_buffer != format_generic_write_to_client)
+        return 0;
+    if (fh->format && fh->format->align_buffer)
+        return 0;
+    return 1;
+}
+
+
+/* plain file content can go directly from the file to the socket, unless it
+ * has to be encrypted */
+static int fserve_use_sendfile (client_t *client, fh_node *fh)
+{
+#ifdef HAVE_SYS_SENDFILE_H
+    if (fserve_plain_content (client, fh) == 0)
+        return 0;
+    if (client->refbuf && client->pos < client->refbuf->len)
+        return 0; /* still data read in to send */
+#ifdef HAVE_OPENSSL
+    if (client->connection.ssl)
+        return 0;
+#endif
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+/* send from the current file position, returns the bytes sent, 0 at the end
+ * of file, -1 if the socket is full and -2 on error */
+static int fserve_sendfile (client_t *client, fh_node *fh, unsigned int len)
+{
+#ifdef HAVE_SYS_SENDFILE_H
+    off_t offset = client->intro_offset;
+    ssize_t ret;
+
+    if (file_in_use (fh->f) == 0)
+        return -2;
+    ret = sendfile (client->connection.sock, fh->f, &offset, len);
+    if (ret < 0)
+    {
+        if (sock_recoverable (sock_error()) == 0)
+        {
+            client->connection.error = 1;
+            return -2;
+        }
+        client->connection.write_blocked = 1;
+        return -1;
+    }
+    client->intro_offset += ret;
+    client->connection.sent_bytes += ret;
+    client->counter += ret;
+    thread_atomic_add (&fserve_sendfile_bytes, ret);
+    return (int)ret;
+#else
+    return -2;
+#endif
+}
+
+
+void fserve_stats (void)
+{
+    stats_event_args (NULL, "fileserve_zero_copy_bytes", "%" PRIu64, fserve_sendfile_bytes);
+    stats_event_args (NULL, "fileserve_copied_bytes", "%" PRIu64, fserve_copied_bytes);
+    thread_mutex_lock (&fh_block_lock);
+    stats_event_args (NULL, "fileserve_cache_hits", "%" PRIu64, fh_block_hits);
+    stats_event_args (NULL, "fileserve_cache_misses", "%" PRIu64, fh_block_misses);
+    stats_event_args (NULL, "fileserve_cache_kbytes", "%" PRIu64, fh_block_resident/1024);
+    thread_mutex_unlock (&fh_block_lock);
+}
+
+
+/* the whole response has been sent, so either the connection is closed or it
+ * is made ready for the next request */
+static int fserve_response_done (client_t *client)
+{
+    fh_node *fh = client->shared_data;
+
+    if ((client->flags & CLIENT_KEEPALIVE) == 0 || client->connection.error)
+        return -1;
+    if (client->flags & CLIENT_AUTHENTICATED)
+    {
+        const char *mount = httpp_getvar (client->parser, HTTPP_VAR_URI);
+        ice_config_t *config = config_get_config ();
+        mount_proxy *mountinfo = config_find_mount (config, mount);
+
+        if (mountinfo && mountinfo->auth && mountinfo->auth->release_listener)
+        {
+            config_release_config();
+            return -1;  /* the authenticator is told when the connection goes */
+        }
+        if (mountinfo && mountinfo->access_log.name)
+            logging_access_id (&mountinfo->access_log, client);
+        config_release_config();
+        client->flags &= ~CLIENT_AUTHENTICATED;
+    }
+    if (fh)
+    {
+        thread_mutex_lock (&fh->lock);
+        remove_from_fh (fh, client);
+        fh_release (fh);
+        client->shared_data = NULL;
+    }
+    _free_fserve_buffers (client);
+    return connection_keepalive (client);
+}
+
+
 struct _client_functions throttled_file_content_ops;
 
 static int prefile_send (client_t *client)
@@ -821,7 +1186,7 @@ static int prefile_send (client_t *client)
                     }
                 }
                 if (client->respcode)
-                    return -1;
+                    return fserve_response_done (client);
                 thread_mutex_lock (&fh->lock);
                 fh_release (fh);
                 return client_send_404 (client, NULL);
@@ -856,13 +1221,15 @@ static int prefile_send (client_t *client)
 /* fast send routine */
 static int file_send (client_t *client)
 {
-    int loop = 6, bytes, written = 0;
+    int loop = 6, bytes, written = 0, use_sendfile, plain;
     fh_node *fh = client->shared_data;
     worker_t *worker = client->worker;
     time_t now;
 
     if (fserve_change_worker (client)) // allow for balancing
         return 1;
+    use_sendfile = fserve_use_sendfile (client, fh);
+    plain = fserve_plain_content (client, fh);
 
     client->schedule_ms = worker->time_ms;
     now = worker->current_time.tv_sec;
@@ -880,9 +1247,32 @@ static int file_send (client_t *client)
             return -1;
         if (client->connection.discon_time && now >= client->connection.discon_time)
             return -1;
-        if (format_file_read (client, fh->format, fh->f) < 0)
-            return -1;
-        bytes = client->check_buffer (client);
+        if (use_sendfile)
+        {
+            bytes = fserve_sendfile (client, fh, 30000 - written);
+            if (bytes == 0)
+                return fserve_response_done (client);
+            if (bytes < -1)
+                return -1;
+        }
+        else if (plain)
+        {
+            bytes = fh_block_send (client, fh);
+            if (bytes == 0)
+                return fserve_response_done (client);
+            if (bytes < -1)
+                return -1;
+            if (bytes > 0)
+                thread_atomic_add (&fserve_copied_bytes, bytes);
+        }
+        else
+        {
+            if (fh_file_read (client, fh) < 0)
+                return -1;
+            bytes = client->check_buffer (client);
+            if (bytes > 0)
+                thread_atomic_add (&fserve_copied_bytes, bytes);
+        }
         if (bytes < 0)
         {
             client->schedule_ms += (written ? 120 : 250);
@@ -950,21 +1340,66 @@ static int throttled_file_send (client_t *client)
         }
         thread_mutex_unlock (&fh->lock);
         if (update_stats)
+        {
+            uint64_t hits, misses, resident;
+
+            thread_mutex_lock (&fh_block_lock);
+            hits = fh->cache_hits;
+            misses = fh->cache_misses;
+            resident = fh->cache_resident;
+            thread_mutex_unlock (&fh_block_lock);
+            stats_lock (fh->stats, NULL);
             stats_set_args (fh->stats, "outgoing_kbitrate", "%ld",
                     (long)((8 * rate_avg (fh->out_bitrate))/1024));
+            stats_set_args (fh->stats, "cache_hits", "%" PRIu64, hits);
+            stats_set_args (fh->stats, "cache_misses", "%" PRIu64, misses);
+            stats_set_args (fh->stats, "cache_resident", "%" PRIu64, resident);
+            stats_release (fh->stats);
+        }
     }
-    switch (format_file_read (client, fh->format, fh->f))
+    if (fserve_use_sendfile (client, fh))
     {
-        case -1: // DEBUG0 ("loop of file triggered");
+        bytes = fserve_sendfile (client, fh, 8192);
+        if (bytes == 0)
+        {
             client->intro_offset = 0;
             client->schedule_ms += 150;
             return 0;
-        case -2: // DEBUG0 ("major failure on read, better leave");
+        }
+        if (bytes < -1)
             return -1;
-        default: //DEBUG1 ("reading from offset %ld", client->intro_offset);
-            break;
     }
-    bytes = client->check_buffer (client);
+    else if (fserve_plain_content (client, fh))
+    {
+        bytes = fh_block_send (client, fh);
+        if (bytes == 0)
+        {
+            client->intro_offset = 0;
+            client->schedule_ms += 150;
+            return 0;
+        }
+        if (bytes < -1)
+            return -1;
+        if (bytes > 0)
+            thread_atomic_add (&fserve_copied_bytes, bytes);
+    }
+    else
+    {
+        switch (fh_file_read (client, fh))
+        {
+            case -1: // DEBUG0 ("loop of file triggered");
+                client->intro_offset = 0;
+                client->schedule_ms += 150;
+                return 0;
+            case -2: // DEBUG0 ("major failure on read, better leave");
+                return -1;
+            default: //DEBUG1 ("reading from offset %ld", client->intro_offset);
+                break;
+        }
+        bytes = client->check_buffer (client);
+        if (bytes > 0)
+            thread_atomic_add (&fserve_copied_bytes, bytes);
+    }
     if (bytes < 0)
         bytes = 0;
     //DEBUG3 ("bytes %d, counter %ld, %ld", bytes, client->counter, client->worker->time_ms - (client->timer_start*1000));
@@ -989,6 +1424,61 @@ struct _client_functions throttled_file_content_ops =
 };
 
 
+/* A kept alive connection needs the end of the response to be known, so add
+ * the headers for that to the first block, working out the length for content
+ * held in memory. If that cannot be done then the connection will close.
+ */
+static void fserve_keepalive_headers (client_t *client, int file_content)
+{
+    refbuf_t *ref = client->refbuf, *r, *hdrs;
+    char *p, *end = NULL;
+    int has_length = 0;
+    uint64_t length = 0;
+
+    client->flags &= ~CLIENT_KEEPALIVE;
+    if (ref == NULL || client->pos)
+        return;
+    for (p = ref->data; p + 4 <= ref->data + ref->len; p++)
+        if (memcmp (p, "\r\n\r\n", 4) == 0)
+        {
+            end = p + 2;
+            break;
+        }
+    if (end == NULL)
+        return;
+    for (p = strchr (ref->data, '\n'); p && p < end; p = strchr (p, '\n'))
+    {
+        p++;
+        if (strncasecmp (p, "Content-Length:", 15) == 0)
+            has_length = 1;
+        if (strncasecmp (p, "Connection:", 11) == 0)
+            return;
+    }
+    if (has_length == 0)
+    {
+        if (file_content)
+            return;
+        length = ref->len - (end + 2 - ref->data);
+        for (r = ref->next; r; r = r->next)
+            length += r->len;
+    }
+    hdrs = refbuf_new (ref->len + 64);
+    memcpy (hdrs->data, ref->data, end - ref->data);
+    p = hdrs->data + (end - ref->data);
+    p += sprintf (p, "Connection: keep-alive\r\n");
+    if (has_length == 0)
+        p += sprintf (p, "Content-Length: %" PRIu64 "\r\n", length);
+    memcpy (p, end, ref->len - (end - ref->data));
+    hdrs->len = (p - hdrs->data) + ref->len - (end - ref->data);
+    hdrs->flags = ref->flags;
+    hdrs->next = ref->next;
+    ref->next = NULL;
+    refbuf_release (ref);
+    client->refbuf = hdrs;
+    client->flags |= CLIENT_KEEPALIVE;
+}
+
+
 /* return 0 for success, -1 for fallback invalid */
 int fserve_setup_client_fb (client_t *client, fbinfo *finfo)
 {
@@ -1050,9 +1540,41 @@ int fserve_setup_client_fb (client_t *client, fbinfo *finfo)
             global_reduce_bitrate_sampling (global.out_bitrate);
         }
         thread_mutex_unlock (&fh->lock);
+        if (client->check_buffer == NULL)
+            client->check_buffer = format_generic_write_to_client;
         if (client->respcode == 0)
-            fill_http_headers (client, finfo->mount, NULL);
+        {
+            struct stat file_buf, *st = NULL;
+
+            /* a plain file can give its length, allowing for ranges and keep-alive */
+            if (fh->finfo.limit == 0 && (client->flags & CLIENT_NO_CONTENT_LENGTH) == 0 &&
+                    fserve_plain_content (client, fh) &&
+                    file_in_use (fh->f) && fstat (fh->f, &file_buf) == 0)
+                st = &file_buf;
+            if (fill_http_headers (client, finfo->mount, st) < 0)
+            {
+                thread_mutex_lock (&fh->lock);
+                remove_from_fh (fh, client);
+                fh_release (fh);
+                client->shared_data = NULL;
+                return client_send_416 (client);
+            }
+        }
         client->mount = fh->finfo.mount;
+        if (client->flags & CLIENT_KEEPALIVE)
+        {
+            if (fh->finfo.limit || (fh->finfo.flags & FS_FALLBACK) || fserve_plain_content (client, fh) == 0)
+                client->flags &= ~CLIENT_KEEPALIVE;
+            else
+                fserve_keepalive_headers (client, 1);
+        }
+    }
+    else if (client->flags & CLIENT_KEEPALIVE)
+    {
+        if (client->check_buffer == NULL || client->check_buffer == format_generic_write_to_client)
+            fserve_keepalive_headers (client, 0);
+        else
+            client->flags &= ~CLIENT_KEEPALIVE;
     }
     if (client->check_buffer == NULL)
         client->check_buffer = format_generic_write_to_client;
@@ -1069,9 +1591,8 @@ int fserve_setup_client_fb (client_t *client, fbinfo *finfo)
     }
     else
     {
-        worker_t *worker = client->worker;
         client->flags |= CLIENT_ACTIVE;
-        worker_wakeup (worker); /* worker may of already processed client but make sure */
+        client_wakeup (client); /* worker may of already processed client but make sure */
     }
     return 0;
 }
@@ -1292,6 +1813,32 @@ int fserve_list_clients_xml (xmlNodePtr parent, fbinfo *finfo)
 }
 
 
+int fserve_list_clients_json (json_t *json, fbinfo *finfo)
+{
+    int ret = 0;
+    fh_node *fh;
+    avl_node *anode;
+
+    avl_tree_rlock (fh_cache);
+    fh = find_fh (finfo);
+    if (fh == NULL)
+    {
+        avl_tree_unlock (fh_cache);
+        return 0;
+    }
+    thread_mutex_lock (&fh->lock);
+    avl_tree_unlock (fh_cache);
+
+    for (anode = avl_get_first (fh->clients); anode; anode = avl_get_next (anode))
+    {
+        stats_listener_to_json (anode->key, json);
+        ret++;
+    }
+    thread_mutex_unlock (&fh->lock);
+    return ret;
+}
+
+
 int fserve_list_clients (client_t *client, const char *mount, int response, int show_listeners)
 {
     int ret;
@@ -20,6 +20,7 @@
 
 
 #include "format.h"
+#include "json.h"
 
 typedef void (*fserve_callback_t)(client_t *, void *);
 
@@ -48,8 +49,11 @@ int  fserve_setup_client_fb (client_t *client, fbinfo *finfo);
 int  fserve_set_override (const char *mount, const char *dest, format_type_t type);
 int  fserve_list_clients (client_t *client, const char *mount, int response, int show_listeners);
 int  fserve_list_clients_xml (xmlNodePtr srcnode, fbinfo *finfo);
+int  fserve_list_clients_json (json_t *json, fbinfo *finfo);
 int  fserve_kill_client (client_t *client, const char *mount, int response);
 int  fserve_query_count (fbinfo *finfo);
+void fserve_stats (void);
+void fserve_recheck_cache (ice_config_t *config);
 
 int  file_in_use (icefile_handle f);
 int  file_open (icefile_handle *f, const char *fn);
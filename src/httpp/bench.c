@@ -0,0 +1,157 @@
+/* bench.c
+**
+** compare the request parser against the way requests were handled before,
+** where the whole buffer was searched for the blank line after each read and
+** the headers were then split up and copied into an avl tree.
+**
+** built from src/httpp after configure, which creates config.h at the top
+** cc -O2 -DHAVE_CONFIG_H -I../.. -I.. -I../thread bench.c httpp.c ../avl/avl.c \
+**     ../thread/thread.c ../log/log.c ../timing/timing.c -lpthread
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/time.h>
+
+#include <avl/avl.h>
+#include "httpp.h"
+
+#define LOOPS 200000
+
+static const char *request =
+    "GET /admin/stats?mount=%2Flive HTTP/1.1\r\n"
+    "Host: radio.example.com:8000\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-GB,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Authorization: Basic YWRtaW46aGFja21l\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://radio.example.com:8000/status.xsl\r\n"
+    "Icy-MetaData: 1\r\n"
+    "\r\n";
+
+
+static int legacy_compare(void *arg, void *a, void *b)
+{
+    return strcmp(((http_var_t *)a)->name, ((http_var_t *)b)->name);
+}
+
+static int legacy_free(void *key)
+{
+    http_var_t *var = key;
+    free(var->name);
+    free(var->value);
+    free(var);
+    return 1;
+}
+
+static void legacy_setvar(avl_tree *tree, const char *name, const char *value)
+{
+    http_var_t *var = malloc(sizeof(http_var_t));
+
+    var->name = strdup(name);
+    var->value = strdup(value);
+    avl_insert(tree, var);
+}
+
+/* the previous approach, minus the request line handling */
+static int legacy_parse(const char *buf, unsigned long len)
+{
+    char *data = malloc(len + 1), *line[32], *p;
+    avl_tree *tree;
+    int lines = 0, i;
+
+    if (strstr(buf, "\r\n\r\n") == NULL && strstr(buf, "\n\n") == NULL)
+    {
+        free(data);
+        return 0;
+    }
+    tree = avl_tree_new(legacy_compare, NULL);
+    memcpy(data, buf, len);
+    data[len] = '\0';
+    line[lines++] = data;
+    for (p = data; *p && lines < 32; p++)
+    {
+        if (*p == '\r')
+            *p = '\0';
+        if (*p == '\n')
+        {
+            *p = '\0';
+            if (p[1] == '\r' || p[1] == '\n')
+                break;
+            line[lines++] = p + 1;
+        }
+    }
+    for (i = 1; i < lines; i++)
+    {
+        char *value = strchr(line[i], ':'), *n;
+
+        if (value == NULL)
+            continue;
+        *value++ = '\0';
+        while (*value == ' ')
+            value++;
+        for (n = line[i]; *n; n++)
+            *n = tolower(*n);
+        legacy_setvar(tree, line[i], value);
+    }
+    legacy_setvar(tree, HTTPP_VAR_URI, "/admin/stats");
+    avl_tree_free(tree, legacy_free);
+    free(data);
+    return 1;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long len = strlen(request), parts[3] = { len / 3, 2 * len / 3, len };
+    char buf[4096];
+    double start;
+    int i, j;
+
+    /* requests arrive in a few reads, each read leads to a parse attempt */
+    start = now();
+    for (i = 0; i < LOOPS; i++)
+    {
+        memset(buf, 0, sizeof(buf));
+        for (j = 0; j < 3; j++)
+        {
+            memcpy(buf, request, parts[j]);
+            if (legacy_parse(buf, parts[j]))
+                break;
+        }
+    }
+    printf("previous parser  %.0f requests/s\n", LOOPS / (now() - start));
+
+    start = now();
+    for (i = 0; i < LOOPS; i++)
+    {
+        http_parser_t *parser = httpp_create_parser();
+
+        httpp_initialize(parser, NULL);
+        memset(buf, 0, sizeof(buf));
+        for (j = 0; j < 3; j++)
+        {
+            memcpy(buf, request, parts[j]);
+            if (httpp_scan(parser, buf, parts[j]) > 0)
+            {
+                httpp_parse(parser, buf, parts[j]);
+                break;
+            }
+        }
+        if (httpp_getvar(parser, "user-agent") == NULL)
+            return 1;
+        httpp_destroy(parser);
+    }
+    printf("scanning parser  %.0f requests/s\n", LOOPS / (now() - start));
+    return 0;
+}
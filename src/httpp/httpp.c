@@ -26,12 +26,27 @@
 #define strcasecmp stricmp
 #endif
 
-#define MAX_HEADERS 32
+/* offsets into the request are kept as shorts */
+#define HTTPP_MAX_LEN 65535
+
+/* states of the request scanner */
+enum {
+    S_REQ_START, S_REQ_TOKEN, S_REQ_SPACE, S_REQ_CR,
+    S_LINE_START, S_BLANK_CR, S_NAME, S_VALUE_SPACE, S_VALUE, S_SKIP, S_DONE
+};
+
+static const char *pseudo_names [httpp_pseudo_count] = {
+    HTTPP_VAR_PROTOCOL, HTTPP_VAR_VERSION, HTTPP_VAR_URI,
+    HTTPP_VAR_RAWURI, HTTPP_VAR_QUERYARGS, HTTPP_VAR_REQ_TYPE,
+    HTTPP_VAR_ERROR_CODE, HTTPP_VAR_ERROR_MESSAGE
+};
 
 /* internal functions */
 
 /* misc */
 static char *_lowercase(char *str);
+static void _set_query_param(http_parser_t *parser, const char *name, int name_len,
+        const char *value, int value_len);
 
 /* for avl trees */
 static int _compare_vars(void *compare_arg, void *a, void *b);
@@ -46,10 +61,9 @@ void httpp_initialize(http_parser_t *parser, http_varlist_t *defaults)
 {
     http_varlist_t *list;
 
+    memset(parser, 0, sizeof(http_parser_t));
     parser->req_type = httpp_req_none;
-    parser->uri = NULL;
-    parser->vars = avl_tree_new(_compare_vars, NULL);
-    parser->queryvars = avl_tree_new(_compare_vars, NULL);
+    parser->state = S_REQ_START;
 
     /* now insert the default variables */
     list = defaults;
@@ -59,132 +73,208 @@ void httpp_initialize(http_parser_t *parser, http_varlist_t *defaults)
     }
 }
 
-static int split_headers(char *data, unsigned long len, char **line)
+/* Look through any further data of the request, recording where the request
+** line and header lines are as we go, so that nothing is looked at twice when
+** the request arrives in pieces. The data passed in must be the same as before
+** with more added. Returns the length of the headers including the blank line
+** once complete, 0 if more is needed or -1 if the headers are too large.
+*/
+int httpp_scan(http_parser_t *parser, const char *http_data, unsigned long len)
 {
-    /* first we count how many lines there are 
-    ** and set up the line[] array     
-    */
-    int lines = 0;
     unsigned long i;
-    line[lines] = data;
-    for (i = 0; i < len && lines < MAX_HEADERS; i++) {
-        if (data[i] == '\r')
-            data[i] = '\0';
-        if (data[i] == '\n') {
-            lines++;
-            data[i] = '\0';
-            if (lines >= MAX_HEADERS)
-                return MAX_HEADERS;
-            if (i + 1 < len) {
-                if (data[i + 1] == '\n' || data[i + 1] == '\r')
-                    break;
-                line[lines] = &data[i + 1];
+    unsigned short state = parser->state;
+    httpp_field_t *field = &parser->fields[parser->field_count];
+
+    if (parser->header_len)
+        return parser->header_len;
+    if (len > HTTPP_MAX_LEN)
+        len = HTTPP_MAX_LEN;
+
+    for (i = parser->scanned; i < len; i++) {
+        char c = http_data[i];
+
+        switch (state) {
+        case S_REQ_START:
+            /* skip any blank lines before the request */
+            if (c == '\r' || c == '\n')
+                break;
+            parser->token[0][0] = i;
+            state = S_REQ_TOKEN;
+            break;
+        case S_REQ_TOKEN:
+            if (c != ' ' && c != '\r' && c != '\n')
+                break;
+            if (parser->tokens < 3)
+                parser->token[parser->tokens++][1] = i;
+            /* fall through */
+        case S_REQ_SPACE:
+            if (c == ' ') {
+                state = S_REQ_SPACE;
+                break;
+            }
+            if (c == '\r' || c == '\n') {
+                parser->line_end = i;
+                state = (c == '\n') ? S_LINE_START : S_REQ_CR;
+                break;
+            }
+            if (parser->tokens < 3)
+                parser->token[parser->tokens][0] = i;
+            state = S_REQ_TOKEN;
+            break;
+        case S_REQ_CR:
+            if (c == '\n')
+                state = S_LINE_START;
+            break;
+        case S_LINE_START:
+            if (c == '\n')
+                state = S_DONE;
+            else if (c == '\r')
+                state = S_BLANK_CR;
+            else if (parser->field_count >= HTTPP_MAX_FIELDS)
+                state = S_SKIP;
+            else {
+                field->name = i;
+                state = S_NAME;
             }
+            break;
+        case S_BLANK_CR:
+            if (c == '\n')
+                state = S_DONE;
+            break;
+        case S_NAME:
+            if (c == ':') {
+                field->name_end = i;
+                state = S_VALUE_SPACE;
+            } else if (c == '\r')
+                state = S_SKIP;
+            else if (c == '\n')
+                state = S_LINE_START;
+            break;
+        case S_VALUE_SPACE:
+            if (c == ' ')
+                break;
+            if (c == '\r')
+                state = S_SKIP;
+            else if (c == '\n')
+                state = S_LINE_START;
+            else {
+                field->value = i;
+                state = S_VALUE;
+            }
+            break;
+        case S_VALUE:
+            if (c != '\r' && c != '\n')
+                break;
+            field->value_end = i;
+            parser->field_count++;
+            field++;
+            state = (c == '\n') ? S_LINE_START : S_SKIP;
+            break;
+        case S_SKIP:
+            if (c == '\n')
+                state = S_LINE_START;
+            break;
+        }
+        if (state == S_DONE) {
+            parser->state = state;
+            parser->scanned = parser->header_len = i + 1;
+            return parser->header_len;
         }
     }
+    parser->state = state;
+    parser->scanned = len;
+    if (len == HTTPP_MAX_LEN)
+        return -1;
+    return 0;
+}
 
-    i++;
-    while (i < len && data[i] == '\n') i++;
+/* scan all of the data, treating the end of it as the end of the headers */
+static int _scan_all(http_parser_t *parser, const char *http_data, unsigned long len)
+{
+    int ret = httpp_scan(parser, http_data, len);
 
-    return lines;
+    if (ret < 0)
+        return 0;
+    if (ret > 0)
+        return 1;
+    switch (parser->state) {
+    case S_REQ_TOKEN:
+        if (parser->tokens < 3)
+            parser->token[parser->tokens++][1] = len;
+        /* fall through */
+    case S_REQ_SPACE:
+        parser->line_end = len;
+        break;
+    case S_VALUE:
+        parser->fields[parser->field_count++].value_end = len;
+        break;
+    }
+    parser->state = S_DONE;
+    parser->header_len = len;
+    return 1;
 }
 
-static void parse_headers(http_parser_t *parser, char **line, int lines)
+/* take a copy of the scanned headers, terminating the names and values in
+** place, with extra space after them for the caller.
+*/
+static char *_copy_request(http_parser_t *parser, const char *http_data, unsigned long extra)
 {
-    int i,l;
-    int whitespace, where, slen;
-    char *name = NULL;
-    char *value = NULL;
-
-    /* parse the name: value lines. */
-    for (l = 1; l < lines; l++) {
-        where = 0;
-        whitespace = 0;
-        name = line[l];
-        value = NULL;
-        slen = strlen(line[l]);
-        for (i = 0; i < slen; i++) {
-            if (line[l][i] == ':') {
-                whitespace = 1;
-                line[l][i] = '\0';
-            } else {
-                if (whitespace) {
-                    whitespace = 0;
-                    while (i < slen && line[l][i] == ' ')
-                        i++;
-
-                    if (i < slen)
-                        value = &line[l][i];
-                    
-                    break;
-                }
-            }
-        }
-        
-        if (name != NULL && value != NULL) {
-            httpp_setvar(parser, _lowercase(name), value);
-            name = NULL; 
-            value = NULL;
+    char *data;
+    int i, j;
+
+    data = (char *)malloc(parser->header_len + 1 + extra);
+    if (data == NULL)
+        return NULL;
+    memcpy(data, http_data, parser->header_len);
+    data[parser->header_len] = '\0';
+
+    for (i = 0; i < parser->tokens && i < 2; i++)
+        data[parser->token[i][1]] = '\0';
+    data[parser->line_end] = '\0';
+
+    for (i = 0; i < parser->field_count; i++) {
+        httpp_field_t *field = &parser->fields[i];
+
+        data[field->name_end] = '\0';
+        data[field->value_end] = '\0';
+        _lowercase(data + field->name);
+        /* a repeated header replaces the earlier one */
+        for (j = 0; j < i; j++) {
+            httpp_field_t *earlier = &parser->fields[j];
+            if (earlier->value && strcmp(data + earlier->name, data + field->name) == 0)
+                earlier->value = 0;
         }
     }
+    free(parser->data);
+    parser->data = data;
+    return data;
 }
 
 int httpp_parse_response(http_parser_t *parser, const char *http_data, unsigned long len, const char *uri)
 {
     char *data;
-    char *line[MAX_HEADERS];
-    int lines, slen,i, whitespace=0, where=0,code;
-    char *version=NULL, *resp_code=NULL, *message=NULL;
-    
-    if(http_data == NULL)
-        return 0;
-
-    /* make a local copy of the data, including 0 terminator */
-    data = (char *)malloc(len+1);
-    if (data == NULL) return 0;
-    memcpy(data, http_data, len);
-    data[len] = 0;
+    int code;
 
-    lines = split_headers(data, len, line);
+    if (http_data == NULL || _scan_all(parser, http_data, len) == 0)
+        return 0;
 
     /* In this case, the first line contains:
      * VERSION RESPONSE_CODE MESSAGE, such as HTTP/1.0 200 OK
      */
-    slen = strlen(line[0]);
-    version = line[0];
-    for(i=0; i < slen; i++) {
-        if(line[0][i] == ' ') {
-            line[0][i] = 0;
-            whitespace = 1;
-        } else if(whitespace) {
-            whitespace = 0;
-            where++;
-            if(where == 1)
-                resp_code = &line[0][i];
-            else {
-                message = &line[0][i];
-                break;
-            }
-        }
-    }
-
-    if(version == NULL || resp_code == NULL || message == NULL) {
-        free(data);
+    if (parser->tokens < 3)
+        return 0;
+    data = _copy_request(parser, http_data, 0);
+    if (data == NULL)
         return 0;
-    }
 
-    httpp_setvar(parser, HTTPP_VAR_ERROR_CODE, resp_code);
-    code = atoi(resp_code);
+    parser->pseudo[httpp_pseudo_error_code] = data + parser->token[1][0];
+    code = atoi(data + parser->token[1][0]);
     if(code < 200 || code >= 300) {
-        httpp_setvar(parser, HTTPP_VAR_ERROR_MESSAGE, message);
+        parser->pseudo[httpp_pseudo_error_message] = data + parser->token[2][0];
     }
 
     httpp_setvar(parser, HTTPP_VAR_URI, uri);
-    httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "NONE");
-
-    parse_headers(parser, line, lines);
-
-    free(data);
+    parser->pseudo[httpp_pseudo_req_type] = "NONE";
 
     return 1;
 }
@@ -201,9 +291,8 @@ static int hex(char c)
         return -1;
 }
 
-static char *url_escape(const char *src)
+static char *url_escape(const char *src, int len)
 {
-    int len = strlen(src);
     unsigned char *decoded;
     int i;
     char *dst;
@@ -251,179 +340,130 @@ static char *url_escape(const char *src)
     return (char *)decoded;
 }
 
-/** TODO: This is almost certainly buggy in some cases */
-static void parse_query(http_parser_t *parser, char *query)
+/* split the key=value pairs, leaving the query string as it is */
+static void parse_query(http_parser_t *parser, const char *query)
 {
-    int len;
-    int i=0;
-    char *key = query;
-    char *val=NULL;
+    const char *key = query;
+    const char *val = NULL;
+    const char *p;
 
     if(!query || !*query)
         return;
 
-    len = strlen(query);
-
-    while(i<len) {
-        switch(query[i]) {
-        case '&':
-            query[i] = 0;
-            if(val && key)
-                httpp_set_query_param(parser, key, val);
-            key = query+i+1;
-            break;
-        case '=':
-            query[i] = 0;
-            val = query+i+1;
-            break;
+    for (p = query; ; p++) {
+        if (*p == '=' && val == NULL)
+            val = p + 1;
+        else if (*p == '&' || *p == '\0') {
+            if (val)
+                _set_query_param(parser, key, val - 1 - key, val, p - val);
+            if (*p == '\0')
+                break;
+            key = p + 1;
+            val = NULL;
         }
-        i++;
-    }
-
-    if(val && key) {
-        httpp_set_query_param(parser, key, val);
     }
 }
 
 int httpp_parse(http_parser_t *parser, const char *http_data, unsigned long len)
 {
-    char *data, *tmp;
-    char *line[MAX_HEADERS]; /* limited to 32 lines, should be more than enough */
-    int i;
-    int lines;
-    char *req_type = NULL;
-    char *uri = NULL;
-    char *version = NULL;
-    int whitespace, where, slen;
+    char *data, *tmp, *uri, *query;
+    char *req_type;
+    char *version;
+    unsigned long uri_len;
 
-    if (http_data == NULL)
+    if (http_data == NULL || _scan_all(parser, http_data, len) == 0)
         return 0;
 
-    /* make a local copy of the data, including 0 terminator */
-    data = (char *)malloc(len+1);
-    if (data == NULL) return 0;
-    memcpy(data, http_data, len);
-    data[len] = 0;
-
-    lines = split_headers(data, len, line);
-
-    /* parse the first line special
+    /* the first line is special
     ** the format is:
     ** REQ_TYPE URI VERSION
     ** eg:
     ** GET /index.html HTTP/1.0
     */
-    where = 0;
-    whitespace = 0;
-    slen = strlen(line[0]);
-    req_type = line[0];
-    for (i = 0; i < slen; i++) {
-        if (line[0][i] == ' ') {
-            whitespace = 1;
-            line[0][i] = '\0';
-        } else {
-            /* we're just past the whitespace boundry */
-            if (whitespace) {
-                whitespace = 0;
-                where++;
-                switch (where) {
-                case 1:
-                    uri = &line[0][i];
-                    break;
-                case 2:
-                    version = &line[0][i];
-                    break;
-                }
-            }
-        }
-    }
+    if (parser->tokens < 2)
+        return 0;
+    uri_len = parser->token[1][1] - parser->token[1][0];
+    data = _copy_request(parser, http_data, uri_len + 1);
+    if (data == NULL)
+        return 0;
 
+    req_type = data + parser->token[0][0];
     if (strcasecmp("GET", req_type) == 0) {
         parser->req_type = httpp_req_get;
+        parser->pseudo[httpp_pseudo_req_type] = "GET";
     } else if (strcasecmp("POST", req_type) == 0) {
         parser->req_type = httpp_req_post;
+        parser->pseudo[httpp_pseudo_req_type] = "POST";
     } else if (strcasecmp("HEAD", req_type) == 0) {
         parser->req_type = httpp_req_head;
+        parser->pseudo[httpp_pseudo_req_type] = "HEAD";
     } else if (strcasecmp("SOURCE", req_type) == 0) {
         parser->req_type = httpp_req_source;
+        parser->pseudo[httpp_pseudo_req_type] = "SOURCE";
     } else if (strcasecmp("PLAY", req_type) == 0) {
         parser->req_type = httpp_req_play;
+        parser->pseudo[httpp_pseudo_req_type] = "PLAY";
     } else if (strcasecmp("STATS", req_type) == 0) {
         parser->req_type = httpp_req_stats;
+        parser->pseudo[httpp_pseudo_req_type] = "STATS";
     } else {
         parser->req_type = httpp_req_unknown;
     }
 
-    if (uri != NULL && strlen(uri) > 0) {
-        char *query;
-        if((query = strchr(uri, '?')) != NULL) {
-            httpp_setvar(parser, HTTPP_VAR_RAWURI, uri);
-            httpp_setvar(parser, HTTPP_VAR_QUERYARGS, query);
-            *query = 0;
-            query++;
-            parse_query(parser, query);
-        }
-
-        parser->uri = strdup(uri);
-    } else {
-        free(data);
+    uri = data + parser->token[1][0];
+    if (uri_len == 0)
         return 0;
+    if ((query = strchr(uri, '?')) != NULL) {
+        /* the path is copied after the headers, the raw uri stays whole */
+        tmp = data + parser->header_len + 1;
+        memcpy(tmp, uri, query - uri);
+        tmp[query - uri] = '\0';
+        parser->pseudo[httpp_pseudo_rawuri] = uri;
+        parser->pseudo[httpp_pseudo_queryargs] = query;
+        parse_query(parser, query + 1);
+        uri = tmp;
     }
+    parser->uri = uri;
 
-    if ((version != NULL) && ((tmp = strchr(version, '/')) != NULL)) {
+    if (parser->tokens < 3)
+        return 0;
+    version = data + parser->token[2][0];
+    data[parser->token[2][1]] = '\0';
+    if ((tmp = strchr(version, '/')) != NULL) {
         tmp[0] = '\0';
         if ((strlen(version) > 0) && (strlen(&tmp[1]) > 0)) {
-            httpp_setvar(parser, HTTPP_VAR_PROTOCOL, version);
-            httpp_setvar(parser, HTTPP_VAR_VERSION, &tmp[1]);
+            parser->pseudo[httpp_pseudo_protocol] = version;
+            parser->pseudo[httpp_pseudo_version] = &tmp[1];
         } else {
-            free(data);
             return 0;
         }
     } else {
-        free(data);
         return 0;
     }
 
-    if (parser->req_type != httpp_req_none && parser->req_type != httpp_req_unknown) {
-        switch (parser->req_type) {
-        case httpp_req_get:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "GET");
-            break;
-        case httpp_req_post:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "POST");
-            break;
-        case httpp_req_head:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "HEAD");
-            break;
-        case httpp_req_source:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "SOURCE");
-            break;
-        case httpp_req_play:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "PLAY");
-            break;
-        case httpp_req_stats:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "STATS");
-            break;
-        default:
-            break;
-        }
-    } else {
-        free(data);
+    if (parser->req_type == httpp_req_none || parser->req_type == httpp_req_unknown)
         return 0;
-    }
 
-    if (parser->uri != NULL) {
-        httpp_setvar(parser, HTTPP_VAR_URI, parser->uri);
-    } else {
-        free(data);
-        return 0;
-    }
+    parser->pseudo[httpp_pseudo_uri] = parser->uri;
 
-    parse_headers(parser, line, lines);
+    return 1;
+}
 
-    free(data);
+/* stop any parsed header or request detail of this name from being found */
+static void _hide_var(http_parser_t *parser, const char *name)
+{
+    int i;
 
-    return 1;
+    for (i = 0; i < httpp_pseudo_count; i++)
+        if (strcmp(pseudo_names[i], name) == 0)
+            parser->pseudo[i] = NULL;
+    if (parser->data == NULL)
+        return;
+    for (i = 0; i < parser->field_count; i++) {
+        httpp_field_t *field = &parser->fields[i];
+        if (field->value && strcmp(parser->data + field->name, name) == 0)
+            field->value = 0;
+    }
 }
 
 void httpp_deletevar(http_parser_t *parser, const char *name)
@@ -432,6 +472,9 @@ void httpp_deletevar(http_parser_t *parser, const char *name)
 
     if (parser == NULL || name == NULL)
         return;
+    _hide_var(parser, name);
+    if (parser->vars == NULL)
+        return;
     var.name = (char*)name;
     var.value = NULL;
     avl_delete(parser->vars, (void *)&var, _free_vars);
@@ -450,6 +493,9 @@ void httpp_setvar(http_parser_t *parser, const char *name, const char *value)
     var->name = strdup(name);
     var->value = strdup(value);
 
+    _hide_var(parser, name);
+    if (parser->vars == NULL)
+        parser->vars = avl_tree_new(_compare_vars, NULL);
     if (httpp_getvar(parser, name) == NULL) {
         avl_insert(parser->vars, (void *)var);
     } else {
@@ -463,8 +509,27 @@ const char *httpp_getvar(http_parser_t *parser, const char *name)
     http_var_t var;
     http_var_t *found;
     void *fp;
+    int i;
 
-    if (parser == NULL || name == NULL || parser->vars == NULL)
+    if (parser == NULL || name == NULL)
+        return NULL;
+
+    if (name[0] == '_' || name[0] == ' ') {
+        for (i = 0; i < httpp_pseudo_count; i++)
+            if (strcmp(pseudo_names[i], name) == 0) {
+                if (parser->pseudo[i])
+                    return parser->pseudo[i];
+                break;
+            }
+    }
+    if (parser->data) {
+        for (i = parser->field_count - 1; i >= 0; i--) {
+            const httpp_field_t *field = &parser->fields[i];
+            if (field->value && strcmp(parser->data + field->name, name) == 0)
+                return parser->data + field->value;
+        }
+    }
+    if (parser->vars == NULL)
         return NULL;
 
     fp = &found;
@@ -477,20 +542,22 @@ const char *httpp_getvar(http_parser_t *parser, const char *name)
         return NULL;
 }
 
-void httpp_set_query_param(http_parser_t *parser, const char *name, const char *value)
+static void _set_query_param(http_parser_t *parser, const char *name, int name_len,
+        const char *value, int value_len)
 {
     http_var_t *var;
 
-    if (name == NULL || value == NULL)
-        return;
-
     var = (http_var_t *)malloc(sizeof(http_var_t));
     if (var == NULL) return;
 
-    var->name = strdup(name);
-    var->value = url_escape(value);
+    var->name = (char *)malloc(name_len + 1);
+    memcpy(var->name, name, name_len);
+    var->name[name_len] = '\0';
+    var->value = url_escape(value, value_len);
 
-    if (httpp_get_query_param(parser, name) == NULL) {
+    if (parser->queryvars == NULL)
+        parser->queryvars = avl_tree_new(_compare_vars, NULL);
+    if (httpp_get_query_param(parser, var->name) == NULL) {
         avl_insert(parser->queryvars, (void *)var);
     } else {
         avl_delete(parser->queryvars, (void *)var, _free_vars);
@@ -498,12 +565,23 @@ void httpp_set_query_param(http_parser_t *parser, const char *name, const char *
     }
 }
 
+void httpp_set_query_param(http_parser_t *parser, const char *name, const char *value)
+{
+    if (name == NULL || value == NULL)
+        return;
+
+    _set_query_param(parser, name, strlen(name), value, strlen(value));
+}
+
 const char *httpp_get_query_param(http_parser_t *parser, const char *name)
 {
     http_var_t var;
     http_var_t *found;
     void *fp;
 
+    if (parser->queryvars == NULL)
+        return NULL;
+
     fp = &found;
     var.name = (char *)name;
     var.value = NULL;
@@ -514,16 +592,74 @@ const char *httpp_get_query_param(http_parser_t *parser, const char *name)
         return NULL;
 }
 
+/* Walk the request details and headers followed by any variables set, the
+** set variables are read locked until httpp_walk_end is called.
+*/
+void httpp_walk_start(http_parser_t *parser, httpp_walk_t *walk)
+{
+    walk->parser = parser;
+    walk->pos = 0;
+    walk->node = NULL;
+    walk->tree = parser->vars;
+    if (walk->tree)
+        avl_tree_rlock(walk->tree);
+}
+
+http_var_t *httpp_walk_next(httpp_walk_t *walk)
+{
+    http_parser_t *parser = walk->parser;
+    int fields_end = httpp_pseudo_count + parser->field_count;
+
+    while (walk->pos < httpp_pseudo_count) {
+        int i = walk->pos++;
+        if (parser->pseudo[i]) {
+            walk->var.name = (char *)pseudo_names[i];
+            walk->var.value = (char *)parser->pseudo[i];
+            return &walk->var;
+        }
+    }
+    while (walk->pos < fields_end) {
+        httpp_field_t *field = &parser->fields[walk->pos++ - httpp_pseudo_count];
+        if (field->value && parser->data) {
+            walk->var.name = parser->data + field->name;
+            walk->var.value = parser->data + field->value;
+            return &walk->var;
+        }
+    }
+    if (walk->tree == NULL)
+        return NULL;
+    if (walk->pos == fields_end) {
+        walk->pos++;
+        walk->node = avl_get_first(walk->tree);
+    } else if (walk->node)
+        walk->node = avl_get_next(walk->node);
+    return walk->node ? (http_var_t *)walk->node->key : NULL;
+}
+
+void httpp_walk_end(httpp_walk_t *walk)
+{
+    if (walk->tree)
+        avl_tree_unlock(walk->tree);
+    walk->tree = NULL;
+}
+
 void httpp_clear(http_parser_t *parser)
 {
     parser->req_type = httpp_req_none;
-    if (parser->uri)
-        free(parser->uri);
     parser->uri = NULL;
-    avl_tree_free(parser->vars, _free_vars);
-    avl_tree_free(parser->queryvars, _free_vars);
+    if (parser->vars)
+        avl_tree_free(parser->vars, _free_vars);
+    if (parser->queryvars)
+        avl_tree_free(parser->queryvars, _free_vars);
     parser->vars = NULL;
     parser->queryvars = NULL;
+    free(parser->data);
+    parser->data = NULL;
+    memset(parser->pseudo, 0, sizeof(parser->pseudo));
+    parser->field_count = 0;
+    parser->tokens = 0;
+    parser->scanned = parser->header_len = 0;
+    parser->state = S_REQ_START;
 }
 
 void httpp_destroy(http_parser_t *parser)
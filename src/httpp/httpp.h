@@ -36,16 +36,50 @@ typedef struct http_varlist_tag {
     struct http_varlist_tag *next;
 } http_varlist_t;
 
+/* maximum number of header lines kept from a request */
+#define HTTPP_MAX_FIELDS 32
+
+/* header line as offsets into the request, value is 0 once removed */
+typedef struct httpp_field_tag {
+    unsigned short name, name_end;
+    unsigned short value, value_end;
+} httpp_field_t;
+
+typedef enum httpp_pseudo_var_tag {
+    httpp_pseudo_protocol, httpp_pseudo_version, httpp_pseudo_uri,
+    httpp_pseudo_rawuri, httpp_pseudo_queryargs, httpp_pseudo_req_type,
+    httpp_pseudo_error_code, httpp_pseudo_error_message, httpp_pseudo_count
+} httpp_pseudo_var_e;
+
 typedef struct http_parser_tag {
     httpp_request_type_e req_type;
     char *uri;
     avl_tree *vars;
     avl_tree *queryvars;
+
+    /* request headers, parsed as they arrive and copied into data at the end */
+    char *data;
+    const char *pseudo [httpp_pseudo_count];
+    unsigned int scanned, header_len;
+    unsigned short state, tokens;
+    unsigned short token [3][2], line_end;
+    unsigned short field_count;
+    httpp_field_t fields [HTTPP_MAX_FIELDS];
 } http_parser_t;
 
+/* for walking all the variables of a parser */
+typedef struct httpp_walk_tag {
+    http_parser_t *parser;
+    avl_tree *tree;
+    avl_node *node;
+    int pos;
+    http_var_t var;
+} httpp_walk_t;
+
 #ifdef _mangle
 # define httpp_create_parser _mangle(httpp_create_parser)
 # define httpp_initialize _mangle(httpp_initialize)
+# define httpp_scan _mangle(httpp_scan)
 # define httpp_parse _mangle(httpp_parse)
 # define httpp_parse_icy _mangle(httpp_parse_icy)
 # define httpp_parse_response _mangle(httpp_parse_response)
@@ -55,10 +89,14 @@ typedef struct http_parser_tag {
 # define httpp_get_query_param _mangle(httpp_get_query_param)
 # define httpp_destroy _mangle(httpp_destroy)
 # define httpp_clear _mangle(httpp_clear)
+# define httpp_walk_start _mangle(httpp_walk_start)
+# define httpp_walk_next _mangle(httpp_walk_next)
+# define httpp_walk_end _mangle(httpp_walk_end)
 #endif
 
 http_parser_t *httpp_create_parser(void);
 void httpp_initialize(http_parser_t *parser, http_varlist_t *defaults);
+int httpp_scan(http_parser_t *parser, const char *http_data, unsigned long len);
 int httpp_parse(http_parser_t *parser, const char *http_data, unsigned long len);
 int httpp_parse_icy(http_parser_t *parser, const char *http_data, unsigned long len);
 int httpp_parse_response(http_parser_t *parser, const char *http_data, unsigned long len, const char *uri);
@@ -69,5 +107,8 @@ void httpp_set_query_param(http_parser_t *parser, const char *name, const char *
 const char *httpp_get_query_param(http_parser_t *parser, const char *name);
 void httpp_destroy(http_parser_t *parser);
 void httpp_clear(http_parser_t *parser);
+void httpp_walk_start(http_parser_t *parser, httpp_walk_t *walk);
+http_var_t *httpp_walk_next(httpp_walk_t *walk);
+void httpp_walk_end(httpp_walk_t *walk);
  
 #endif
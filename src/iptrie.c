@@ -0,0 +1,424 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* iptrie.c
+ *
+ * path compressed binary trie of IPv4/IPv6 address prefixes, used for the
+ * ban/allow lists. Lookups walk at most one node per prefix bit.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+#include "iptrie.h"
+
+struct iptrie_node
+{
+    iptrie_node *child [2];
+    time_t timeout;
+    unsigned char key [IPTRIE_ADDR_LEN];
+    unsigned char bits;     /* prefix length */
+    unsigned char used;     /* holds an entry, not just a branch point */
+};
+
+#define IPTRIE_JUMP_BITS    16
+#define IPTRIE_JUMP_MIN     1024    /* entries before a jump table is worth it */
+
+/* where a lookup of an IPv4 address continues from, and the best match above
+ * that point. Only built on compacted tries, as they cannot change */
+struct iptrie_jump
+{
+    iptrie_node *start;
+    iptrie_node *match;
+};
+
+static const unsigned char v4_mapped [12] = { 0,0,0,0, 0,0,0,0, 0,0,0xFF,0xFF };
+
+
+static inline int key_bit (const unsigned char *key, int bit)
+{
+    return (key [bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/* number of leading bits the keys have in common, up to limit */
+static int common_bits (const unsigned char *a, const unsigned char *b, int limit)
+{
+    int i = 0;
+
+    for (; i < limit; i += 8)
+    {
+        unsigned char x = a [i >> 3] ^ b [i >> 3];
+        if (x)
+        {
+            while ((x & 0x80) == 0)
+            {
+                x <<= 1;
+                i++;
+            }
+            break;
+        }
+    }
+    return i < limit ? i : limit;
+}
+
+static void mask_key (unsigned char *dst, const unsigned char *key, int bits)
+{
+    int bytes = bits >> 3;
+
+    memset (dst, 0, IPTRIE_ADDR_LEN);
+    memcpy (dst, key, bytes);
+    if (bits & 7)
+        dst [bytes] = key [bytes] & (0xFF << (8 - (bits & 7)));
+}
+
+static iptrie_node *node_new (const unsigned char *key, int bits)
+{
+    iptrie_node *node = calloc (1, sizeof (iptrie_node));
+
+    if (node)
+    {
+        mask_key (node->key, key, bits);
+        node->bits = bits;
+    }
+    return node;
+}
+
+static void node_free (iptrie_node *node)
+{
+    if (node)
+    {
+        node_free (node->child[0]);
+        node_free (node->child[1]);
+        free (node);
+    }
+}
+
+
+iptrie *iptrie_new (void)
+{
+    return calloc (1, sizeof (iptrie));
+}
+
+
+void iptrie_free (iptrie *trie)
+{
+    if (trie)
+    {
+        free (trie->jump);
+        if (trie->block)
+            free (trie->block);
+        else
+            node_free (trie->root);
+        free (trie);
+    }
+}
+
+
+static long node_count (iptrie_node *node)
+{
+    return node ? 1 + node_count (node->child[0]) + node_count (node->child[1]) : 0;
+}
+
+/* move the nodes into one block in breadth first order so that the top of the
+ * trie, which every lookup passes through, is close together in memory. Only
+ * lookups and copying can be done afterwards. */
+void iptrie_compact (iptrie *trie)
+{
+    long count = node_count (trie->root), head = 0, tail = 1;
+    iptrie_node *block;
+
+    if (trie->block || count == 0)
+        return;
+    block = malloc (count * sizeof (iptrie_node));
+    if (block == NULL)
+        return;
+    block[0] = *trie->root;
+    free (trie->root);
+    for (; head < tail; head++)
+    {
+        int i;
+        for (i = 0; i < 2; i++)
+        {
+            iptrie_node *child = block [head].child [i];
+            if (child)
+            {
+                block [tail] = *child;
+                free (child);
+                block [head].child [i] = &block [tail++];
+            }
+        }
+    }
+    trie->root = trie->block = block;
+
+    if (trie->count >= IPTRIE_JUMP_MIN)
+        trie->jump = calloc (1 << IPTRIE_JUMP_BITS, sizeof (struct iptrie_jump));
+    if (trie->jump)
+    {
+        unsigned char key [IPTRIE_ADDR_LEN];
+        int slot, limit = 96 + IPTRIE_JUMP_BITS;
+
+        memset (key, 0, sizeof (key));
+        memcpy (key, v4_mapped, sizeof (v4_mapped));
+        for (slot = 0; slot < (1 << IPTRIE_JUMP_BITS); slot++)
+        {
+            iptrie_node *node = trie->root, *match = NULL;
+
+            key [12] = slot >> 8;
+            key [13] = slot & 0xFF;
+            while (node && node->bits <= limit)
+            {
+                if (common_bits (node->key, key, node->bits) < node->bits)
+                {
+                    node = NULL;
+                    break;
+                }
+                if (node->used)
+                    match = node;
+                if (node->bits == limit)
+                    break;
+                node = node->child [key_bit (key, node->bits)];
+            }
+            trie->jump [slot].start = node;
+            trie->jump [slot].match = match;
+        }
+    }
+}
+
+
+static void copy_nodes (iptrie *dst, iptrie_node *node, time_t now)
+{
+    if (node == NULL)
+        return;
+    if (node->used && (node->timeout == 0 || node->timeout > now))
+        iptrie_insert (dst, node->key, node->bits, node->timeout);
+    copy_nodes (dst, node->child[0], now);
+    copy_nodes (dst, node->child[1], now);
+}
+
+/* duplicate the trie, leaving out entries that have expired */
+iptrie *iptrie_copy (iptrie *trie, time_t now)
+{
+    iptrie *copy = iptrie_new ();
+
+    if (copy && trie)
+        copy_nodes (copy, trie->root, now);
+    return copy;
+}
+
+
+int iptrie_parse (const char *str, unsigned char *addr, int *bits)
+{
+    char buf [64];
+    const char *slash = strchr (str, '/');
+    int len = slash ? slash - str : strlen (str), prefix = -1;
+
+    if (len <= 0 || len >= (int)sizeof (buf))
+        return -1;
+    memcpy (buf, str, len);
+    buf [len] = '\0';
+    if (slash)
+    {
+        char *end;
+        prefix = strtol (slash+1, &end, 10);
+        if (end == slash+1 || *end || prefix < 0)
+            return -1;
+    }
+    memset (addr, 0, IPTRIE_ADDR_LEN);
+    if (strchr (buf, ':'))
+    {
+        if (inet_pton (AF_INET6, buf, addr) <= 0 || prefix > 128)
+            return -1;
+        *bits = prefix < 0 ? 128 : prefix;
+        return 0;
+    }
+    else
+    {
+        /* IPv4, with a.b.* or a.b.*.* being the same as a.b.0.0/16 */
+        int octets = 0, fixed = 0, wild = 0;
+        char *p = buf;
+
+        while (octets < 4)
+        {
+            char *end;
+            long v;
+
+            if (*p == '*' && (p[1] == '\0' || p[1] == '.'))
+            {
+                wild = 1;
+                p++;
+            }
+            else
+            {
+                if (wild)
+                    return -1;
+                v = strtol (p, &end, 10);
+                if (end == p || v < 0 || v > 255)
+                    return -1;
+                addr [12 + octets] = v;
+                fixed++;
+                p = end;
+            }
+            octets++;
+            if (*p == '\0')
+                break;
+            if (*p++ != '.')
+                return -1;
+        }
+        if (*p || (octets < 4 && wild == 0) || prefix > 32 || (wild && prefix >= 0))
+            return -1;
+        /* a lone * matches IPv6 clients as well, so leave it as a pattern */
+        if (wild && fixed == 0)
+            return -1;
+        if (wild)
+            prefix = fixed * 8;
+        addr [10] = addr [11] = 0xFF;
+        *bits = 96 + (prefix < 0 ? 32 : prefix);
+        return 0;
+    }
+}
+
+
+int iptrie_insert (iptrie *trie, const unsigned char *addr, int bits, time_t timeout)
+{
+    iptrie_node **p = &trie->root, *node;
+
+    if (trie->block)
+        return -1;
+    while ((node = *p))
+    {
+        int common = common_bits (node->key, addr, bits < node->bits ? bits : node->bits);
+
+        if (common < node->bits)
+        {
+            /* the new prefix is not below this node, so insert above it */
+            iptrie_node *entry = node_new (addr, bits);
+
+            if (entry == NULL)
+                return -1;
+            if (common == bits)
+            {
+                entry->child [key_bit (node->key, bits)] = node;
+                *p = entry;
+            }
+            else
+            {
+                iptrie_node *branch = node_new (addr, common);
+                if (branch == NULL)
+                {
+                    free (entry);
+                    return -1;
+                }
+                branch->child [key_bit (addr, common)] = entry;
+                branch->child [key_bit (node->key, common)] = node;
+                *p = branch;
+            }
+            node = entry;
+            break;
+        }
+        if (node->bits == bits)
+            break;
+        p = &node->child [key_bit (addr, node->bits)];
+    }
+    if (node == NULL)
+    {
+        node = *p = node_new (addr, bits);
+        if (node == NULL)
+            return -1;
+    }
+    if (node->used == 0)
+    {
+        node->used = 1;
+        trie->count++;
+    }
+    else if (node->timeout == 0)
+        return 0;   /* already permanent */
+    node->timeout = timeout;
+    if (timeout && (trie->expires == 0 || timeout < trie->expires))
+        trie->expires = timeout;
+    return 0;
+}
+
+
+/* returns the replacement for the subtree after removal */
+static iptrie_node *remove_node (iptrie *trie, iptrie_node *node, const unsigned char *addr, int bits)
+{
+    if (node == NULL || node->bits > bits || common_bits (node->key, addr, node->bits) < node->bits)
+        return node;
+    if (node->bits < bits)
+    {
+        int b = key_bit (addr, node->bits);
+        node->child [b] = remove_node (trie, node->child [b], addr, bits);
+    }
+    else if (node->used)
+    {
+        node->used = 0;
+        trie->count--;
+    }
+    if (node->used == 0 && (node->child[0] == NULL || node->child[1] == NULL))
+    {
+        iptrie_node *child = node->child[0] ? node->child[0] : node->child[1];
+        free (node);
+        return child;
+    }
+    return node;
+}
+
+int iptrie_remove (iptrie *trie, const unsigned char *addr, int bits)
+{
+    long count = trie->count;
+
+    if (trie->block)
+        return -1;
+    trie->root = remove_node (trie, trie->root, addr, bits);
+    return count == trie->count ? -1 : 0;
+}
+
+
+time_t *iptrie_match (iptrie *trie, const unsigned char *addr, time_t now)
+{
+    iptrie_node *node = trie ? trie->root : NULL;
+    time_t *match = NULL;
+
+    if (node && trie->jump && memcmp (addr, v4_mapped, sizeof (v4_mapped)) == 0)
+    {
+        struct iptrie_jump *jump = &trie->jump [(addr[12] << 8) | addr[13]];
+
+        node = jump->start;
+        if (jump->match && (jump->match->timeout == 0 || jump->match->timeout > now))
+            match = &jump->match->timeout;
+    }
+    while (node)
+    {
+        if (common_bits (node->key, addr, node->bits) < node->bits)
+            break;
+        if (node->used && (node->timeout == 0 || node->timeout > now))
+            match = &node->timeout;
+        if (node->bits >= IPTRIE_ADDR_LEN * 8)
+            break;
+        node = node->child [key_bit (addr, node->bits)];
+    }
+    return match;
+}
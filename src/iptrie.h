@@ -0,0 +1,54 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* iptrie.h
+ *
+ * path compressed binary trie of IPv4/IPv6 address prefixes
+ *
+ */
+#ifndef __IPTRIE_H
+#define __IPTRIE_H
+
+#include <time.h>
+
+#define IPTRIE_ADDR_LEN     16      /* IPv4 is held as ::ffff:a.b.c.d */
+
+typedef struct iptrie_node iptrie_node;
+struct iptrie_jump;
+
+typedef struct iptrie
+{
+    iptrie_node *root;
+    iptrie_node *block; /* nodes after compacting, no longer changeable */
+    struct iptrie_jump *jump;   /* IPv4 starting points by the first 16 bits */
+    long count;
+    time_t expires;     /* earliest entry timeout, 0 for none */
+} iptrie;
+
+iptrie *iptrie_new (void);
+void    iptrie_free (iptrie *trie);
+iptrie *iptrie_copy (iptrie *trie, time_t now);
+void    iptrie_compact (iptrie *trie);
+
+/* parse an address with an optional /prefix, also taking a.b.* style wildcards
+ * (not a lone *, which is left to the pattern matcher as it covers IPv6 too),
+ * returns 0 on success */
+int     iptrie_parse (const char *str, unsigned char *addr, int *bits);
+
+int     iptrie_insert (iptrie *trie, const unsigned char *addr, int bits, time_t timeout);
+int     iptrie_remove (iptrie *trie, const unsigned char *addr, int bits);
+
+/* find the most specific prefix holding the address that has not expired, a
+ * pointer to its timeout is returned or NULL if there is no match */
+time_t *iptrie_match (iptrie *trie, const unsigned char *addr, time_t now);
+
+#endif /* __IPTRIE_H */
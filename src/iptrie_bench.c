@@ -0,0 +1,169 @@
+/* iptrie_bench.c
+**
+** compare address lookups in the prefix trie, as used for the ban and allow
+** lists, against the way the lists were held before, as text in an avl tree
+** searched with the fnmatch based compare_pattern.
+**
+** built from src after configure, which creates config.h at the top
+** cc -O2 -DHAVE_CONFIG_H -I.. -I. iptrie_bench.c iptrie.c avl/avl.c \
+**     thread/thread.c log/log.c timing/timing.c -lpthread
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#ifdef HAVE_FNMATCH_H
+#include <fnmatch.h>
+#endif
+
+#include <avl/avl.h>
+#include "iptrie.h"
+
+#define ENTRIES     1000000
+#define LOOKUPS     1000000
+
+
+/* as connection.c had it for the ban and allow lists */
+static int compare_pattern (void *arg, void *a, void *b)
+{
+    const char *value = (const char *)a;
+    const char *pattern = (const char *)b;
+#ifdef HAVE_FNMATCH_H
+    int x;
+
+    switch ((x = fnmatch (pattern, value, FNM_NOESCAPE)))
+    {
+        case FNM_NOMATCH:
+            x = strcmp (pattern, value);
+        case 0:
+            break;
+        default:
+            return -1;
+    }
+    return x;
+#else
+    return strcmp (pattern, value);
+#endif
+}
+
+static int free_text (void *x)
+{
+    free (x);
+    return 1;
+}
+
+
+static unsigned int seed = 12345;
+
+static unsigned int next_random (void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+
+/* alternate pairs are IPv4 and IPv6, odd numbered ones differ from any even
+ * numbered one so they can be left out of the list */
+static void make_address (char *buf, size_t len, unsigned int i)
+{
+    unsigned int r = next_random ();
+
+    if (i & 2)
+        snprintf (buf, len, "2001:db8:%x:%x::%x:%x", r & 0xffff, (r >> 8) & 0xffff, i >> 16, i & 0xffff);
+    else
+        snprintf (buf, len, "%u.%u.%u.%u", 10 + (i & 1), (r >> 16) & 255, (r >> 8) & 255, r & 255);
+}
+
+
+static double now (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+int main (void)
+{
+    char **addrs = calloc (LOOKUPS, sizeof (char *));
+    char **extra = calloc (ENTRIES / 2, sizeof (char *));
+    avl_tree *tree = avl_tree_new (compare_pattern, NULL);
+    iptrie *trie = iptrie_new ();
+    unsigned char addr [IPTRIE_ADDR_LEN];
+    unsigned long found_avl = 0, found_trie = 0;
+    double start, t_avl, t_trie, t_avl_load, t_trie_load;
+    char buf [64];
+    unsigned int i;
+    int bits;
+
+    /* a lookup is made for each of these, half of them are in the list */
+    for (i = 0; i < LOOKUPS; i++)
+    {
+        make_address (buf, sizeof buf, i);
+        addrs [i] = strdup (buf);
+    }
+    /* the rest of the list, which is never looked up */
+    for (i = 0; i < ENTRIES / 2; i++)
+    {
+        make_address (buf, sizeof buf, i * 2);
+        extra [i] = strdup (buf);
+    }
+
+    start = now ();
+    for (i = 0; i < LOOKUPS; i += 2)
+        avl_insert (tree, strdup (addrs [i]));
+    for (i = 0; i < ENTRIES / 2; i++)
+    {
+        char *str = strdup (extra [i]);
+        if (avl_insert (tree, str) < 0)
+            free (str);
+    }
+    t_avl_load = now () - start;
+
+    start = now ();
+    for (i = 0; i < LOOKUPS; i += 2)
+        if (iptrie_parse (addrs [i], addr, &bits) == 0)
+            iptrie_insert (trie, addr, bits, 0);
+    for (i = 0; i < ENTRIES / 2; i++)
+        if (iptrie_parse (extra [i], addr, &bits) == 0)
+            iptrie_insert (trie, addr, bits, 0);
+    iptrie_compact (trie);
+    t_trie_load = now () - start;
+
+    start = now ();
+    for (i = 0; i < LOOKUPS; i++)
+    {
+        void *result;
+        if (avl_get_by_key (tree, addrs [i], &result) == 0)
+            found_avl++;
+    }
+    t_avl = now () - start;
+
+    start = now ();
+    for (i = 0; i < LOOKUPS; i++)
+    {
+        if (iptrie_parse (addrs [i], addr, &bits) == 0 && iptrie_match (trie, addr, 0))
+            found_trie++;
+    }
+    t_trie = now () - start;
+
+    printf ("%ld entries in avl, %ld in trie, %d lookups each\n",
+            (long)tree->length, trie->count, LOOKUPS);
+    printf ("avl + fnmatch  load %6.2fs  %9.0f lookups/s  %lu found\n", t_avl_load, LOOKUPS / t_avl, found_avl);
+    printf ("prefix trie    load %6.2fs  %9.0f lookups/s  %lu found\n", t_trie_load, LOOKUPS / t_trie, found_trie);
+
+    avl_tree_free (tree, free_text);
+    iptrie_free (trie);
+    for (i = 0; i < LOOKUPS; i++)
+        free (addrs [i]);
+    for (i = 0; i < ENTRIES / 2; i++)
+        free (extra [i]);
+    free (addrs);
+    free (extra);
+    return 0;
+}
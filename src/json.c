@@ -0,0 +1,237 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* json.c
+ *
+ * append only writer of compact JSON text, used for the stats so they can be
+ * sent without building an XML document first.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "json.h"
+
+
+static void json_append (json_t *json, const char *s, unsigned int len)
+{
+    if (json->len + len >= json->size)
+    {
+        while (json->len + len >= json->size)
+            json->size *= 2;
+        json->data = realloc (json->data, json->size);
+        if (json->data == NULL)
+            abort();
+    }
+    memcpy (json->data + json->len, s, len);
+    json->len += len;
+}
+
+
+/* length of the valid UTF-8 sequence at p, 0 if it is not valid */
+static int json_utf8_len (const unsigned char *p)
+{
+    int i, len;
+
+    if (*p < 0xC2 || *p > 0xF4)
+        return 0;
+    len = (*p >= 0xF0) ? 4 : (*p >= 0xE0) ? 3 : 2;
+    for (i = 1; i < len; i++)
+        if ((p[i] & 0xC0) != 0x80)
+            return 0;
+    /* overlong and surrogate forms */
+    if ((p[0] == 0xE0 && p[1] < 0xA0) || (p[0] == 0xED && p[1] > 0x9F) ||
+            (p[0] == 0xF0 && p[1] < 0x90) || (p[0] == 0xF4 && p[1] > 0x8F))
+        return 0;
+    return len;
+}
+
+
+static void json_append_string (json_t *json, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *p = (const unsigned char *)str;
+
+    json_append (json, "\"", 1);
+    while (*p)
+    {
+        const unsigned char *start = p;
+        char esc [8];
+
+        while (*p >= 0x20 && *p < 0x80 && *p != '"' && *p != '\\')
+            p++;
+        if (p > start)
+        {
+            json_append (json, (const char *)start, p - start);
+            continue;
+        }
+        if (*p >= 0x80)
+        {
+            int len = json_utf8_len (p);
+
+            if (len)
+                json_append (json, (const char *)p, len);
+            else
+            {
+                /* invalid byte, replaced so the output remains valid */
+                json_append (json, "\\ufffd", 6);
+                len = 1;
+            }
+            p += len;
+            continue;
+        }
+        switch (*p)
+        {
+            case '"':  json_append (json, "\\\"", 2); break;
+            case '\\': json_append (json, "\\\\", 2); break;
+            case '\n': json_append (json, "\\n", 2); break;
+            case '\r': json_append (json, "\\r", 2); break;
+            case '\t': json_append (json, "\\t", 2); break;
+            default:
+                memcpy (esc, "\\u00", 4);
+                esc[4] = hex [*p >> 4];
+                esc[5] = hex [*p & 15];
+                json_append (json, esc, 6);
+        }
+        p++;
+    }
+    json_append (json, "\"", 1);
+}
+
+
+/* the separator and member name before a value */
+static void json_member (json_t *json, const char *name)
+{
+    int depth = json->depth < JSON_MAX_DEPTH ? json->depth : JSON_MAX_DEPTH - 1;
+
+    if (json->items [depth])
+        json_append (json, ",", 1);
+    json->items [depth] = 1;
+    if (name)
+    {
+        json_append_string (json, name);
+        json_append (json, ":", 1);
+    }
+}
+
+
+static void json_open (json_t *json, const char *name, const char *c)
+{
+    json_member (json, name);
+    json_append (json, c, 1);
+    json->depth++;
+    if (json->depth < JSON_MAX_DEPTH)
+        json->items [json->depth] = 0;
+}
+
+
+static void json_close (json_t *json, const char *c)
+{
+    json->depth--;
+    json_append (json, c, 1);
+}
+
+
+void json_init (json_t *json, unsigned int size)
+{
+    memset (json, 0, sizeof (*json));
+    json->size = size < 16 ? 16 : size;
+    json->data = malloc (json->size);
+    if (json->data == NULL)
+        abort();
+}
+
+
+void json_start_object (json_t *json, const char *name)
+{
+    json_open (json, name, "{");
+}
+
+void json_end_object (json_t *json)
+{
+    json_close (json, "}");
+}
+
+void json_start_array (json_t *json, const char *name)
+{
+    json_open (json, name, "[");
+}
+
+void json_end_array (json_t *json)
+{
+    json_close (json, "]");
+}
+
+
+void json_add_string (json_t *json, const char *name, const char *value)
+{
+    json_member (json, name);
+    if (value)
+        json_append_string (json, value);
+    else
+        json_append (json, "null", 4);
+}
+
+
+/* add a number held as text, for values known to be numeric. Anything that
+ * does not parse as a number is written as a string so the output stays valid */
+void json_add_number (json_t *json, const char *name, const char *value)
+{
+    const char *p = value;
+
+    if (p && *p == '-')
+        p++;
+    if (p && *p >= '0' && *p <= '9' && strlen (p) < 20)
+    {
+        if (*p == '0')
+            p++;
+        else
+            p += strspn (p, "0123456789");
+        if (*p == '.' && p[1] >= '0' && p[1] <= '9')
+            p += 1 + strspn (p + 1, "0123456789");
+        if (*p == '\0')
+        {
+            json_member (json, name);
+            json_append (json, value, p - value);
+            return;
+        }
+    }
+    json_add_string (json, name, value);
+}
+
+
+void json_add_int (json_t *json, const char *name, int64_t value)
+{
+    char buf [24];
+    int len = snprintf (buf, sizeof buf, "%" PRId64, value);
+
+    json_member (json, name);
+    json_append (json, buf, len);
+}
+
+
+/* the text written, which the caller now owns and must free */
+char *json_finish (json_t *json, unsigned int *len)
+{
+    char *data = json->data;
+
+    *len = json->len;
+    json->data = NULL;
+    json->len = json->size = 0;
+    return data;
+}
@@ -0,0 +1,46 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* json.h
+ *
+ * append only writer of compact JSON text into a growing buffer
+ *
+ */
+#ifndef __JSON_H
+#define __JSON_H
+
+#include <stdint.h>
+
+#define JSON_MAX_DEPTH      16
+
+typedef struct json
+{
+    char *data;
+    unsigned int len;
+    unsigned int size;
+    int depth;
+    unsigned char items [JSON_MAX_DEPTH];   /* anything written yet at each depth */
+} json_t;
+
+/* name is the member name within an object, NULL for array entries or the
+ * top level value */
+void  json_init (json_t *json, unsigned int size);
+void  json_start_object (json_t *json, const char *name);
+void  json_end_object (json_t *json);
+void  json_start_array (json_t *json, const char *name);
+void  json_end_array (json_t *json);
+void  json_add_string (json_t *json, const char *name, const char *value);
+void  json_add_number (json_t *json, const char *name, const char *value);
+void  json_add_int (json_t *json, const char *name, int64_t value);
+char *json_finish (json_t *json, unsigned int *len);
+
+#endif /* __JSON_H */
@@ -445,13 +445,11 @@ int mpeg_complete_frames (mpeg_sync *mp, refbuf_t *new_block, unsigned offset)
             offset -= mp->surplus->len;
         else
         {
-            int new_len = mp->surplus->len + new_block->len;
-            unsigned char *p = realloc (mp->surplus->data, new_len);
+            unsigned int surplus_len = mp->surplus->len, block_len = new_block->len;
 
-            memcpy (p+mp->surplus->len, new_block->data, new_block->len);
-            mp->surplus->data = new_block->data;
-            new_block->data = (void*)p;
-            new_block->len = new_len;
+            refbuf_expand (new_block, surplus_len + block_len);
+            memmove (new_block->data + surplus_len, new_block->data, block_len);
+            memcpy (new_block->data, mp->surplus->data, surplus_len);
         }
         refbuf_release (mp->surplus);
         mp->surplus = NULL;
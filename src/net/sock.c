@@ -772,7 +772,7 @@ sock_t sock_connect_wto_bind (const char *hostname, int port, const char *bnd, i
 }
 
 
-sock_t sock_get_server_socket (int port, const char *sinterface)
+sock_t sock_get_server_socket (int port, const char *sinterface, int reuseport)
 {
     struct sockaddr_storage sa;
     struct addrinfo hints, *res, *ai;
@@ -803,6 +803,10 @@ sock_t sock_get_server_socket (int port, const char *sinterface)
 
         sock_set_cloexec (sock);
         setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&on, sizeof(on));
+#ifdef SO_REUSEPORT
+        if (reuseport)
+            setsockopt (sock, SOL_SOCKET, SO_REUSEPORT, (const void *)&on, sizeof(on));
+#endif
         on = 0;
 #ifdef IPV6_V6ONLY
         setsockopt (sock, IPPROTO_IPV6, IPV6_V6ONLY, (void*)&on, sizeof on);
@@ -925,10 +929,11 @@ sock_t sock_connect_wto_bind (const char *hostname, int port, const char *bnd, i
 /* sock_get_server_socket
 **
 ** create a socket for incoming requests on a specified port and
-** interface.  if interface is null, listen on all interfaces.
+** interface.  if interface is null, listen on all interfaces. reuseport
+** allows several sockets to be bound to the port where supported.
 ** returns the socket, or SOCK_ERROR on failure
 */
-sock_t sock_get_server_socket(int port, const char *sinterface)
+sock_t sock_get_server_socket(int port, const char *sinterface, int reuseport)
 {
     struct sockaddr_in sa;
     int error, opt;
@@ -967,6 +972,10 @@ sock_t sock_get_server_socket(int port, const char *sinterface)
     /* reuse it if we can */
     opt = 1;
     setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&opt, sizeof(int));
+#ifdef SO_REUSEPORT
+    if (reuseport)
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const void *)&opt, sizeof(int));
+#endif
 
     /* bind socket to port */
     error = bind(sock, (struct sockaddr *)&sa, sizeof (struct sockaddr_in));
@@ -1005,11 +1014,18 @@ sock_t sock_accept(sock_t serversock, char *ip, size_t len)
     socklen_t slen;
 
     slen = sizeof(sa);
+#ifdef HAVE_ACCEPT4
+    /* the new socket is non-blocking from the start */
+    ret = accept4(serversock, (struct sockaddr *)&sa, &slen, SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
     ret = accept(serversock, (struct sockaddr *)&sa, &slen);
+#endif
 
     if (ret != SOCK_ERROR)
     {
+#ifndef HAVE_ACCEPT4
         sock_set_cloexec (ret);
+#endif
         if (ip)
         {
 #ifdef HAVE_GETNAMEINFO
@@ -140,7 +140,7 @@ int sock_read_line(sock_t sock, char *string, const int len);
 int sock_read_pending(sock_t sock, unsigned timeout);
 
 /* server socket functions */
-sock_t sock_get_server_socket(int port, const char *sinterface);
+sock_t sock_get_server_socket(int port, const char *sinterface, int reuseport);
 int sock_listen(sock_t serversock, int backlog);
 sock_t sock_accept(sock_t serversock, char *ip, size_t len);
 
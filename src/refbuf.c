@@ -23,55 +23,291 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "thread/thread.h"
 #include "refbuf.h"
 
 #define CATMODULE "refbuf"
 
 #include "logging.h"
 #include "global.h"
+#include "stats.h"
+
+/* Blocks of the common sizes are allocated with the data inline after the
+ * header, and on release kept on a free list for the thread doing the release,
+ * up to a limit, so that they can be reused without going back to malloc.
+ */
+#define REFBUF_POOL_CLASSES     6
+#define REFBUF_POOL_CACHE_BYTES (512*1024)
+
+static const unsigned int refbuf_pool_sizes [REFBUF_POOL_CLASSES] = { 128, 512, 1536, 4096, 8192, 16384 };
+
+struct refbuf_pool
+{
+    refbuf_t *free [REFBUF_POOL_CLASSES];
+    unsigned int free_count [REFBUF_POOL_CLASSES];
+    uint64_t hits, misses;
+    int64_t in_use;     /* bytes, may go negative if released on another thread */
+    struct refbuf_pool *next;
+};
+
+static int refbuf_pool_active;
+static pthread_key_t refbuf_pool_key;
+static mutex_t refbuf_pool_lock;
+static struct refbuf_pool *refbuf_pools;
+static uint64_t refbuf_hits_retired, refbuf_misses_retired;
+static int64_t refbuf_in_use_retired;
+
+
+static void refbuf_pool_free (struct refbuf_pool *pool)
+{
+    int i;
+
+    for (i = 0; i < REFBUF_POOL_CLASSES; i++)
+    {
+        while (pool->free [i])
+        {
+            refbuf_t *r = pool->free [i];
+            pool->free [i] = r->next;
+            free (r);
+        }
+        pool->free_count [i] = 0;
+    }
+}
+
+
+/* called on thread exit, drop the cached blocks and keep the counts */
+static void refbuf_pool_release (void *arg)
+{
+    struct refbuf_pool *pool = arg, **p;
+
+    refbuf_pool_free (pool);
+    thread_mutex_lock (&refbuf_pool_lock);
+    for (p = &refbuf_pools; *p; p = &(*p)->next)
+    {
+        if (*p == pool)
+        {
+            *p = pool->next;
+            break;
+        }
+    }
+    refbuf_hits_retired += pool->hits;
+    refbuf_misses_retired += pool->misses;
+    refbuf_in_use_retired += pool->in_use;
+    thread_mutex_unlock (&refbuf_pool_lock);
+    free (pool);
+}
+
+
+static struct refbuf_pool *refbuf_pool_get (void)
+{
+    struct refbuf_pool *pool;
+
+    if (refbuf_pool_active == 0)
+        return NULL;
+    pool = pthread_getspecific (refbuf_pool_key);
+    if (pool == NULL)
+    {
+        pool = calloc (1, sizeof (*pool));
+        if (pool == NULL)
+            abort();
+        pthread_setspecific (refbuf_pool_key, pool);
+        thread_mutex_lock (&refbuf_pool_lock);
+        pool->next = refbuf_pools;
+        refbuf_pools = pool;
+        thread_mutex_unlock (&refbuf_pool_lock);
+    }
+    return pool;
+}
+
+
+static int refbuf_pool_class (unsigned int size)
+{
+    int i;
+
+    if (size == 0 || refbuf_pool_active == 0)
+        return -1;
+    for (i = 0; i < REFBUF_POOL_CLASSES; i++)
+        if (size <= refbuf_pool_sizes [i])
+            return i;
+    return -1;
+}
+
+
+static refbuf_t *refbuf_pool_alloc (int class)
+{
+    struct refbuf_pool *pool = refbuf_pool_get ();
+    refbuf_t *refbuf = NULL;
+
+    if (pool == NULL)
+        return NULL;
+    if (pool->free [class])
+    {
+        refbuf = pool->free [class];
+        pool->free [class] = refbuf->next;
+        pool->free_count [class]--;
+        pool->hits++;
+    }
+    else
+    {
+        refbuf = malloc (sizeof (refbuf_t) + refbuf_pool_sizes [class]);
+        if (refbuf == NULL)
+            abort();
+        pool->misses++;
+    }
+    pool->in_use += refbuf_pool_sizes [class];
+    memset (refbuf, 0, sizeof (refbuf_t));
+    refbuf->_class = class + 1;
+    refbuf->data = (char *)(refbuf + 1);
+    return refbuf;
+}
+
+
+static void refbuf_pool_put (refbuf_t *refbuf)
+{
+    int class = refbuf->_class - 1;
+    struct refbuf_pool *pool = refbuf_pool_get ();
+
+    /* the data may have been swapped for a larger block */
+    if (refbuf->data != (char *)(refbuf + 1))
+        free (refbuf->data);
+    if (pool == NULL)
+    {
+        free (refbuf);
+        return;
+    }
+    pool->in_use -= refbuf_pool_sizes [class];
+    if (pool->free_count [class] >= REFBUF_POOL_CACHE_BYTES / refbuf_pool_sizes [class])
+    {
+        free (refbuf);
+        return;
+    }
+    refbuf->next = pool->free [class];
+    pool->free [class] = refbuf;
+    pool->free_count [class]++;
+}
 
 
 void refbuf_initialize(void)
 {
+    thread_mutex_create (&refbuf_pool_lock);
+    if (pthread_key_create (&refbuf_pool_key, refbuf_pool_release) == 0)
+        refbuf_pool_active = 1;
 }
 
 void refbuf_shutdown(void)
 {
+    struct refbuf_pool *pool;
+
+    if (refbuf_pool_active == 0)
+        return;
+    pool = pthread_getspecific (refbuf_pool_key);
+    refbuf_pool_active = 0;
+    if (pool)
+    {
+        pthread_setspecific (refbuf_pool_key, NULL);
+        refbuf_pool_release (pool);
+    }
+    pthread_key_delete (refbuf_pool_key);
+    thread_mutex_destroy (&refbuf_pool_lock);
 }
 
+
+void refbuf_stats (void)
+{
+    uint64_t hits = refbuf_hits_retired, misses = refbuf_misses_retired;
+    int64_t in_use = refbuf_in_use_retired, cached = 0;
+    struct refbuf_pool *pool;
+
+    if (refbuf_pool_active == 0)
+        return;
+    thread_mutex_lock (&refbuf_pool_lock);
+    for (pool = refbuf_pools; pool; pool = pool->next)
+    {
+        int i;
+        hits += pool->hits;
+        misses += pool->misses;
+        in_use += pool->in_use;
+        for (i = 0; i < REFBUF_POOL_CLASSES; i++)
+            cached += (int64_t)pool->free_count [i] * refbuf_pool_sizes [i];
+    }
+    thread_mutex_unlock (&refbuf_pool_lock);
+    stats_event_args (NULL, "refbuf_pool_hit_rate", "%.1f", (hits + misses) ? (hits * 100.0) / (hits + misses) : 0.0);
+    stats_event_args (NULL, "refbuf_pool_resident_kbytes", "%" PRId64, (in_use + cached) / 1024);
+    stats_event_args (NULL, "refbuf_pool_cached_kbytes", "%" PRId64, cached / 1024);
+}
+
+
 refbuf_t *refbuf_new (unsigned int size)
 {
-    refbuf_t *refbuf;
+    refbuf_t *refbuf = NULL;
+    int class = refbuf_pool_class (size);
 
-    refbuf = (refbuf_t *)calloc(1, sizeof(refbuf_t));
+    if (class >= 0)
+        refbuf = refbuf_pool_alloc (class);
     if (refbuf == NULL)
-        abort();
-    refbuf->data = NULL;
-    if (size)
     {
-        refbuf->data = malloc (size);
-        if (refbuf->data == NULL)
+        refbuf = (refbuf_t *)calloc(1, sizeof(refbuf_t));
+        if (refbuf == NULL)
             abort();
+        refbuf->data = NULL;
+        if (size)
+        {
+            refbuf->data = malloc (size);
+            if (refbuf->data == NULL)
+                abort();
+        }
     }
     refbuf->len = size;
     refbuf->_count = 1;
     refbuf->next = NULL;
     refbuf->associated = NULL;
+    refbuf->rendition = NULL;
 
     return refbuf;
 }
 
+
+/* make the data block larger, keeping the existing contents. The data pointer
+ * may change so must be used instead of realloc on it */
+void refbuf_expand (refbuf_t *refbuf, unsigned int newlen)
+{
+    char *p;
+
+    if (refbuf->_class && refbuf->data == (char *)(refbuf + 1))
+    {
+        if (newlen > refbuf_pool_sizes [refbuf->_class - 1])
+        {
+            p = malloc (newlen);
+            if (p == NULL)
+                abort();
+            memcpy (p, refbuf->data, refbuf->len < newlen ? refbuf->len : newlen);
+            refbuf->data = p;
+        }
+    }
+    else
+    {
+        p = realloc (refbuf->data, newlen);
+        if (p == NULL)
+            abort();
+        refbuf->data = p;
+    }
+    refbuf->len = newlen;
+}
+
 void refbuf_addref(refbuf_t *self)
 {
     if (self == NULL)
         return;
-    self->_count++;
+    thread_atomic_add (&self->_count, 1);
 }
 
 refbuf_t *refbuf_copy(refbuf_t *orig)
 {
     refbuf_t *ret = refbuf_new (orig->len), *ref = ret;
     memcpy (ref->data, orig->data, orig->len);
+    /* a rendition is never changed so can be shared */
+    ref->rendition = orig->rendition;
+    refbuf_addref (ref->rendition);
     orig = orig->associated;
     while (orig)
     {
@@ -102,14 +338,19 @@ void refbuf_release(refbuf_t *self)
 {
     if (self == NULL)
         return;
-    self->_count--;
-    if (self->_count == 0)
+    if (thread_atomic_sub (&self->_count, 1) == 0)
     {
         refbuf_release_associated (self->associated);
+        refbuf_release (self->rendition);
         if (self->next)
             DEBUG0 ("next not null");
-        free(self->data);
-        free(self);
+        if (self->_class)
+            refbuf_pool_put (self);
+        else
+        {
+            free(self->data);
+            free(self);
+        }
     }
 }
 
@@ -20,6 +20,14 @@
 
 #include <sys/types.h>
 
+/* The reference count is atomic, so a block can be held and released from
+ * any thread without a common lock, as the file block cache and the cached
+ * stats do with blocks shared between workers. Once a block is shared its
+ * data, len, associated and rendition blocks must not be changed, a block that
+ * has to change must be copied with refbuf_copy first. Source queue blocks are
+ * not held by listeners, they are walked under the source lock, and next is
+ * cleared when a block is dropped off the queue.
+ */
 typedef struct _refbuf_tag
 {
     unsigned int flags;
@@ -28,6 +36,8 @@ typedef struct _refbuf_tag
     struct _refbuf_tag *associated;
     char *data;
     unsigned int len;
+    unsigned int _class;    /* pool size class + 1, 0 if separately allocated */
+    struct _refbuf_tag *rendition;  /* the same data in another form, eg flv wrapped */
 
 } refbuf_t;
 
@@ -35,6 +45,8 @@ void refbuf_initialize(void);
 void refbuf_shutdown(void);
 
 refbuf_t *refbuf_new(unsigned int size);
+void refbuf_expand (refbuf_t *refbuf, unsigned int newlen);
+void refbuf_stats (void);
 void refbuf_addref(refbuf_t *self);
 void refbuf_release(refbuf_t *self);
 refbuf_t *refbuf_copy(refbuf_t *orig);
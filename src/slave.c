@@ -518,7 +518,7 @@ static void *start_relay_stream (void *arg)
 
         if (open_relay (relay) < 0)
             break;
-        stats_event_inc (NULL, "source_relay_connections");
+        stats_counter_inc (STATS_CTR_SOURCE_RELAY_CONNECTIONS);
         source_init (src);
         failed = 0;
     } while (0);
@@ -548,7 +548,7 @@ static void *start_relay_stream (void *arg)
     thread_spin_unlock (&relay_start_lock);
 
     client->flags |= CLIENT_ACTIVE;
-    worker_wakeup (client->worker);
+    client_wakeup (client);
     return NULL;
 }
 
@@ -587,8 +587,7 @@ int relay_toggle (relay_server *relay)
         ret = 1;
     }
     relay->running = relay->running ? 0 : 1;
-    client->schedule_ms = 0;
-    worker_wakeup (client->worker);
+    client_wakeup (client);
     slave_update_all_mounts();
     return ret;
 }
@@ -657,7 +656,7 @@ update_relay_set (relay_server **current, relay_server *updated)
                     INFO1 ("relay details changed on \"%s\", restarting", new->localmount);
                     existing_relay->new_details = new;
                     if (source && source->client)
-                        source->client->schedule_ms = 0;
+                        client_schedule_now (source->client);
                 }
                 *existing_p = existing_relay->next; /* leave client to free structure */
                 new->next = new_list;
@@ -708,7 +707,7 @@ static void update_relays (relay_server **relay_list, relay_server *new_relay_li
         if (source && source->client)
         {
             INFO1 ("relay shutdown request on \"%s\"", to_release->localmount);
-            source->client->schedule_ms = 0;
+            client_schedule_now (source->client);
         }
         to_release->cleanup = 1;
     }
@@ -1038,6 +1037,7 @@ static void slave_startup (void)
     redirector_setup (config);
     update_master_as_slave (config);
     stats_global (config);
+    workers_config (config);
     workers_adjust (config->workers_count);
     yp_initialize (config);
     config_release_config();
@@ -1097,6 +1097,8 @@ static void _slave_thread(void)
             }
         }
         stats_global_calc();
+        if (connection_running)
+            connection_recheck_files (current.tv_sec);
 
         /* allow for terminating icecast if no streams running */
         if (inactivity_timer)
@@ -1520,7 +1522,7 @@ static int relay_startup (client_t *client)
         dest_worker = worker_selected ();
         if (dest_worker != worker)
         {
-            long diff = worker->count - dest_worker->count;
+            long diff = worker_load (worker) - worker_load (dest_worker);
             if (diff > 5)
             {
                 worker->move_allocations--;
@@ -76,6 +76,7 @@ static int  http_source_listener (client_t *client);
 static int  http_source_intro (client_t *client);
 static int  locate_start_on_queue (source_t *source, client_t *client);
 static int  listener_change_worker (client_t *client, source_t *source);
+static int  listener_place_worker (source_t *source, client_t *client);
 static int  source_change_worker (source_t *source, client_t *client);
 static int  source_client_callback (client_t *client);
 static int  source_set_override (const char *mount, source_t *dest_source, format_type_t type);
@@ -366,8 +367,8 @@ static void update_source_stats (source_t *source)
                 (uint64_t)(worker->current_time.tv_sec - source->client->connection.con_time));
     }
     stats_release (source->stats);
-    stats_event_add (NULL, "stream_kbytes_sent", kbytes_sent);
-    stats_event_add (NULL, "stream_kbytes_read", kbytes_read);
+    stats_counter_add (STATS_CTR_STREAM_KBYTES_SENT, kbytes_sent);
+    stats_counter_add (STATS_CTR_STREAM_KBYTES_READ, kbytes_read);
 
     source->bytes_sent_since_update %= 1024;
     source->bytes_read_since_update %= 1024;
@@ -420,7 +421,7 @@ int source_read (source_t *source)
         {
             INFO2("listener count on %s now %lu", source->mount, source->listeners);
             source->prev_listeners = source->listeners;
-            stats_event_args (source->mount, "listeners", "%lu", source->listeners);
+            stats_mount_counter_set (source->stats, source->mount, STATS_MOUNT_LISTENERS, source->listeners);
             if (source->listeners > source->peak_listeners)
             {
                 source->peak_listeners = source->listeners;
@@ -558,7 +559,7 @@ void source_listeners_wakeup (source_t *source)
         client_t *client = (client_t *)node->key;
         if (s->schedule_ms + 100 < client->schedule_ms)
             DEBUG2 ("listener on %s was ahead by %ld", source->mount, (long)(client->schedule_ms - s->schedule_ms));
-        client->schedule_ms = 0;
+        client_schedule_now (client);
         node = avl_get_next (node);
     }
 }
@@ -680,7 +681,7 @@ static int source_queue_advance (client_t *client)
     {
         INFO4 ("Client %" PRIu64 " (%s) has fallen too far behind (%"PRIu64") on %s, removing",
                 client->connection.id, client->connection.ip, client->queue_pos, source->mount);
-        stats_event_inc (source->mount, "slow_listeners");
+        stats_mount_counter_add (source->stats, source->mount, STATS_MOUNT_SLOW_LISTENERS, 1);
         client->refbuf = NULL;
         client->connection.error = 1;
         return -1;
@@ -689,6 +690,8 @@ static int source_queue_advance (client_t *client)
     if ((refbuf->flags & SOURCE_QUEUE_BLOCK) == 0 || refbuf->len > 10000)  abort();
 
     ret = source->format->write_buf_to_client (client);
+    /* the write may have moved on through the queue */
+    refbuf = client->refbuf;
     /* move to the next buffer if we have finished with the current one */
     if (client->pos >= refbuf->len)
     {
@@ -834,7 +837,7 @@ static int http_source_listener (client_t *client)
             return -1;
         }
         client->flags |= CLIENT_HAS_INTRO_CONTENT;
-        stats_event_inc (source->mount, "listener_connections");
+        stats_mount_counter_add (source->stats, source->mount, STATS_MOUNT_LISTENER_CONNECTIONS, 1);
     }
     ret = format_generic_write_to_client (client);
     if (client->pos == refbuf->len)
@@ -1103,7 +1106,7 @@ void source_init (source_t *source)
     }
 
     /* start off the statistics */
-    stats_event_inc (NULL, "source_total_connections");
+    stats_counter_inc (STATS_CTR_SOURCE_TOTAL_CONNECTIONS);
     stats_event_flags (source->mount, "slow_listeners", "0", STATS_COUNTERS);
     stats_event (source->mount, "server_type", source->format->contenttype);
     stats_event_flags (source->mount, "listener_peak", "0", STATS_COUNTERS);
@@ -1622,14 +1625,14 @@ static int source_client_callback (client_t *client)
     agent = httpp_getvar (source->client->parser, "user-agent");
     if (agent)
         stats_event_flags (source->mount, "user_agent", agent, STATS_COUNTERS);
-    stats_event_inc(NULL, "source_client_connections");
+    stats_counter_inc (STATS_CTR_SOURCE_CLIENT_CONNECTIONS);
     client_set_queue (client, NULL);
 
     client->ops = &source_client_ops;
     if (source_running (source))
     {
         thread_rwlock_unlock (&source->lock);
-        stats_event_inc (NULL, "source_total_connections");
+        stats_counter_inc (STATS_CTR_SOURCE_TOTAL_CONNECTIONS);
     }
     else
         source_init (source);
@@ -1850,7 +1853,7 @@ static int source_listener_release (source_t *source, client_t *client)
     if (source->listeners == 0)
         rate_reduce (source->out_bitrate, 500);
 
-    stats_event_dec (NULL, "listeners");
+    stats_counter_dec (STATS_CTR_LISTENERS);
     /* change of listener numbers, so reduce scope of global sampling */
     global_reduce_bitrate_sampling (global.out_bitrate);
 
@@ -1868,7 +1871,7 @@ static int source_listener_release (source_t *source, client_t *client)
 
 int source_add_listener (const char *mount, mount_proxy *mountinfo, client_t *client)
 {
-    int loop = 10, rate = 0, do_process = 0;
+    int loop = 10, rate = 0, do_process = 0, placed = 0;
     int within_limits;
     source_t *source;
     mount_proxy *minfo = mountinfo;
@@ -1915,8 +1918,8 @@ int source_add_listener (const char *mount, mount_proxy *mountinfo, client_t *cl
                     if (move_listener (client, &f) == 0)
                     {
                         /* source dead but fallback to file found */
-                        stats_event_inc (NULL, "listeners");
-                        stats_event_inc (NULL, "listener_connections");
+                        stats_counter_inc (STATS_CTR_LISTENERS);
+                        stats_counter_inc (STATS_CTR_LISTENER_CONNECTIONS);
                         return 0;
                     }
                 }
@@ -1978,7 +1981,7 @@ int source_add_listener (const char *mount, mount_proxy *mountinfo, client_t *cl
                     client->refbuf->next = p;
                     return fserve_setup_client_fb (client, NULL);
                 }
-                stats_event_inc (source->mount, "listener_connections");
+                stats_mount_counter_add (source->stats, source->mount, STATS_MOUNT_LISTENER_CONNECTIONS, 1);
             }
         }
 
@@ -2042,18 +2045,28 @@ int source_add_listener (const char *mount, mount_proxy *mountinfo, client_t *cl
 
     source_setup_listener (source, client);
     if ((client->flags & CLIENT_ACTIVE) && (source->flags & SOURCE_RUNNING))
+    {
         do_process = 1;
+        placed = listener_place_worker (source, client);
+    }
     else
     {
         client->flags |= CLIENT_ACTIVE; // from an auth thread context
-        worker_wakeup (client->worker);
+        client_wakeup (client);
     }
     thread_rwlock_unlock (&source->lock);
     global_reduce_bitrate_sampling (global.out_bitrate);
 
-    stats_event_inc (NULL, "listeners");
-    stats_event_inc (NULL, "listener_connections");
+    stats_counter_inc (STATS_CTR_LISTENERS);
+    stats_counter_inc (STATS_CTR_LISTENER_CONNECTIONS);
 
+    if (placed < 0)
+        stats_counter_inc (STATS_CTR_AFFINITY_SPILLOVER);
+    if (placed > 0)
+    {
+        stats_counter_inc (STATS_CTR_AFFINITY_PLACED);
+        return 1;  /* now on the source worker, processed there */
+    }
     if (do_process) // send something back quickly
         return client->ops->process (client);
     return 0;
@@ -2084,9 +2097,8 @@ void source_setup_listener (source_t *source, client_t *client)
     source->listeners++;
     if ((source->flags & (SOURCE_ON_DEMAND|SOURCE_RUNNING)) == SOURCE_ON_DEMAND)
     {
-        source->client->schedule_ms = 0;
         client->schedule_ms += 300;
-        worker_wakeup (source->client->worker);
+        client_wakeup (source->client);
         DEBUG0 ("woke up relay");
     }
 }
@@ -2126,7 +2138,6 @@ static void source_swap_client (source_t *source, client_t *client)
     client->shared_data = source;
     source->client = client;
 
-    old_client->schedule_ms = client->worker->time_ms;
     old_client->shared_data = NULL;
     old_client->flags &= ~CLIENT_AUTHENTICATED;
     old_client->connection.sent_bytes = source->format->read_bytes;
@@ -2137,7 +2148,7 @@ static void source_swap_client (source_t *source, client_t *client)
     if (source->format->swap_client)
         source->format->swap_client (client, old_client);
 
-    worker_wakeup (old_client->worker);
+    client_wakeup (old_client);
 }
 
 
@@ -2208,7 +2219,7 @@ int source_startup (client_t *client, const char *uri)
             thread_rwlock_unlock (&source->lock);
         }
         client->flags |= CLIENT_ACTIVE;
-        worker_wakeup (client->worker);
+        client_wakeup (client);
     }
     else
     {
@@ -2233,16 +2244,54 @@ static int source_change_worker (source_t *source, client_t *client)
     worker = worker_selected ();
     if (worker && worker != client->worker)
     {
-        long diff = this_worker->count - worker->count;
+        long diff = worker_load (this_worker) - worker_load (worker);
         if (diff > 20 || (diff > (source->listeners>>1) + 3))
         {
             this_worker->move_allocations--;
+            source->group_from = this_worker;
+            source->group_until = this_worker->time_ms + 2000;
             thread_rwlock_unlock (&source->lock);
             ret = client_change_worker (client, worker);
             if (ret)
                 DEBUG2 ("moving source from %p to %p", this_worker, worker);
             else
+            {
                 thread_rwlock_wlock (&source->lock);
+                source->group_from = NULL;
+            }
+        }
+    }
+    thread_rwlock_unlock (&workers_lock);
+    return ret;
+}
+
+
+/* Called with the source locked when a listener is first added and is being
+ * processed by its worker. Place it on the worker of the source client if that
+ * has room, rather than waiting for the listener to be migrated later. Returns
+ * 1 if moved, -1 if the source worker is too busy so it stays where it is.
+ */
+static int listener_place_worker (source_t *source, client_t *client)
+{
+    worker_t *this_worker = client->worker, *dest_worker;
+    int ret = 0;
+
+    if (worker_count < 2 || source->client == NULL)
+        return 0;
+    thread_rwlock_rlock (&workers_lock);
+    dest_worker = source->client->worker;
+    if (dest_worker && dest_worker != this_worker)
+    {
+        worker_t *least = worker_selected ();
+        long diff = worker_load (dest_worker) - worker_load (least);
+
+        // same headroom as listener_change_worker uses for migration
+        if (diff > 10)
+            ret = -1;
+        else if (client_change_worker (client, dest_worker))
+        {
+            DEBUG2 ("placing listener from %p on %p", this_worker, dest_worker);
+            ret = 1;
         }
     }
     thread_rwlock_unlock (&workers_lock);
@@ -2252,37 +2301,43 @@ static int source_change_worker (source_t *source, client_t *client)
 
 /* move listener client to worker theread that the source is on. This will
  * help cache but prevent overloading a single worker with many listeners.
+ * Listeners left behind when the source was moved for balancing follow it
+ * without limit, so the whole group ends up on the same worker.
  */
 int listener_change_worker (client_t *client, source_t *source)
 {
     worker_t *this_worker = client->worker, *dest_worker;
     long diff;
-    int ret = 0;
+    int ret = 0, group;
 
-    if (this_worker->move_allocations == 0 || worker_count < 2)
+    if (worker_count < 2)
+        return 0;
+    group = (source->group_from == this_worker && this_worker->time_ms < source->group_until) ? 1 : 0;
+    if (this_worker->move_allocations == 0 && group == 0)
         return 0;
     thread_rwlock_rlock (&workers_lock);
     dest_worker = source->client->worker;
 
     if (this_worker != dest_worker)
     {
-        diff = dest_worker->count - this_worker->count;
-        // do not move listener if source client worker has sufficiently more clients
-        if (diff > 10)
+        diff = worker_load (dest_worker) - worker_load (this_worker);
+        // do not move listener if source client worker is sufficiently busier
+        if (diff > 10 && group == 0)
             dest_worker = NULL;
     }
     else
     {
         dest_worker = worker_selected ();
         // do not move if least busy worker is significantly less than ours
-        diff = this_worker->count - dest_worker->count;
+        diff = worker_load (this_worker) - worker_load (dest_worker);
         if (diff < 25)
             dest_worker = NULL;
     }
     if (dest_worker)
     {
         // called when allocations is positive, only do so many of these in one go.
-        this_worker->move_allocations--;
+        if (group == 0)
+            this_worker->move_allocations--;
 
         thread_rwlock_unlock (&source->lock);
         ret = client_change_worker (client, dest_worker);
@@ -2294,6 +2349,8 @@ int listener_change_worker (client_t *client, source_t *source)
     else
         this_worker->move_allocations = 0;
     thread_rwlock_unlock (&workers_lock);
+    if (ret)
+        stats_counter_inc (STATS_CTR_WORKER_MOVES);
     return ret;
 }
 
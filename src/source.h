@@ -75,6 +75,11 @@ typedef struct source_tag
 
     time_t last_read;
 
+    /* when the source client is moved to balance workers, its listeners on the
+     * old worker follow it as a group for a short while */
+    worker_t *group_from;
+    uint64_t group_until;
+
     rwlock_t lock;
 
     refbuf_t *stream_data;
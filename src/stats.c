@@ -42,6 +42,7 @@
 #include "xslt.h"
 #include "util.h"
 #include "fserve.h"
+#include "json.h"
 #define CATMODULE "stats"
 #include "logging.h"
 
@@ -51,6 +52,10 @@
 
 #define VAL_BUFSIZE 20
 #define STATS_BLOCK_CONNECTION  01
+#define STATS_BLOCK_SIZE        1400
+
+#define STATS_HISTORY_SECONDS   300     /* last 5 minutes at 1 second */
+#define STATS_HISTORY_MINUTES   1440    /* last day at 1 minute */
 
 #define STATS_EVENT_SET     0
 #define STATS_EVENT_INC     1
@@ -78,24 +83,74 @@ typedef struct _stats_event_tag
     struct _stats_event_tag *next;
 } stats_event_t;
 
+/* a sample of the figures kept in the history */
+typedef struct
+{
+    uint32_t listeners;
+    uint32_t slow_listeners;
+    uint32_t in_kbitrate;
+    uint32_t out_kbitrate;
+    uint64_t connections;
+} stats_sample_t;
+
+/* rings of samples for a mount or the whole server, a slot is found by
+ * the time it is for, so 1 second samples go in slot time % size */
+typedef struct
+{
+    time_t first, last;
+    stats_sample_t second [STATS_HISTORY_SECONDS];
+    stats_sample_t minute [STATS_HISTORY_MINUTES];
+    stats_sample_t sum;     /* over the current minute so far */
+    unsigned int sum_count;
+} stats_history_t;
+
 typedef struct _stats_source_tag
 {
     char *source;
     int  flags;
     avl_tree *stats_tree;
+
+    /* counters and the values last written into the tree */
+    int64_t counter [STATS_MOUNT_COUNT];
+    int64_t shown [STATS_MOUNT_COUNT];
+
+    /* bumped on each change, and the xml made for the generation in xml */
+    unsigned long generation, xml_generation;
+    refbuf_t *xml;
+
+    /* under the history lock, bitrates from the source for the next sample */
+    stats_history_t *history;
+    uint32_t in_kbitrate, out_kbitrate;
 } stats_source_t;
 
+/* The events for stats clients with the same mask are written once into a
+ * chain of blocks shared by them all. Each client holds the block it is
+ * sending from, each link holds the block after it and the feed holds the
+ * block being added to, so blocks go once every client has moved past them.
+ * All of it is only changed with the listeners lock held.
+ */
+typedef struct _stats_feed_tag
+{
+    int mask;
+    unsigned int listeners;
+    uint64_t written;       /* bytes added since the feed started */
+    refbuf_t *tail;
+
+    struct _stats_feed_tag *next;
+} stats_feed_t;
+
 typedef struct _event_listener_tag
 {
     int mask;
-    unsigned int content_len;
     char *source;
 
-    /* queue for unwritten stats to stats clients */
+    /* the initial stats, queued before joining the feed */
     refbuf_t *recent_block;
-    client_t *client;
+    uint64_t queued;
 
-    struct _event_listener_tag *next;
+    stats_feed_t *feed;
+    uint64_t feed_start;    /* feed bytes before joining */
+    uint64_t sent;
 } event_listener_t;
 
 
@@ -104,16 +159,58 @@ typedef struct _stats_tag
     avl_tree *global_tree;
     avl_tree *source_tree;
 
-    /* list of listeners for stats */
-    event_listener_t *event_listeners;
+    /* shared event feeds for stats clients */
+    stats_feed_t *feeds;
     mutex_t listeners_lock;
 
+    /* changes to the global stats and to the set of sources */
+    unsigned long global_generation, sources_generation;
+
+    /* the serialised xml of all the stats, and the parts it was made from */
+    mutex_t xml_lock;
+    refbuf_t *xml_doc, *xml_global;
+    unsigned long xml_global_generation, xml_sources_generation;
+
+    mutex_t history_lock;
+    stats_history_t *history;
+
 } stats_t;
 
 static volatile int _stats_running = 0;
 
 static stats_t _stats;
 
+/* Global counters are added to by the thread doing the update into cells of
+ * its own, found through a pthread key. The cells are only summed, and the
+ * totals written as strings into the global tree, when the stats are read.
+ */
+struct stats_counter_cells
+{
+    int64_t value [STATS_CTR_COUNT];
+    struct stats_counter_cells *next;
+};
+
+static const char *stats_counter_names [STATS_CTR_COUNT] =
+{
+    "clients", "connections", "listeners", "client_connections",
+    "listener_connections", "source_client_connections",
+    "source_relay_connections", "source_total_connections", "file_connections",
+    "stream_kbytes_sent", "stream_kbytes_read", "listener_affinity_placed",
+    "listener_affinity_spillover", "listener_worker_moves"
+};
+
+static const char *stats_mount_counter_names [STATS_MOUNT_COUNT] =
+{
+    "listeners", "listener_connections", "slow_listeners"
+};
+
+static int stats_counter_active;
+static pthread_key_t stats_counter_key;
+static mutex_t stats_counter_lock;
+static struct stats_counter_cells *stats_counter_list;
+static int64_t stats_counter_retired [STATS_CTR_COUNT];
+static int64_t stats_counter_shown [STATS_CTR_COUNT];
+
 
 static int _compare_stats(void *a, void *b, void *arg);
 static int _compare_source_stats(void *a, void *b, void *arg);
@@ -122,8 +219,14 @@ static int _free_source_stats(void *key);
 static stats_node_t *_find_node(const avl_tree *tree, const char *name);
 static stats_source_t *_find_source(avl_tree *tree, const char *source);
 static void process_event (stats_event_t *event);
-static void _add_stats_to_stats_client (client_t *client, const char *fmt, va_list ap);
+static void stats_feed_append (stats_feed_t *feed, const char *fmt, va_list ap);
 static void stats_listener_send (int flags, const char *fmt, ...);
+static void stats_counter_release (void *arg);
+static void stats_counters_sync (void);
+static void process_source_stat (stats_source_t *src_stats, stats_event_t *event);
+static void stats_mount_counters_sync (stats_source_t *src_stats);
+static void stats_mount_counter_reset (stats_source_t *src_stats, stats_event_t *event);
+static void stats_history_sample (time_t now);
 
 unsigned int throttle_sends;
 
@@ -151,11 +254,21 @@ void stats_initialize(void)
     _stats.global_tree = avl_tree_new(_compare_stats, NULL);
     _stats.source_tree = avl_tree_new(_compare_source_stats, NULL);
 
-    _stats.event_listeners = NULL;
+    _stats.feeds = NULL;
     thread_mutex_create (&_stats.listeners_lock);
+    thread_mutex_create (&_stats.xml_lock);
+    thread_mutex_create (&_stats.history_lock);
+    _stats.global_generation = _stats.sources_generation = 1;
 
     _stats_running = 1;
 
+    if (stats_counter_active == 0)
+    {
+        thread_mutex_create (&stats_counter_lock);
+        pthread_key_create (&stats_counter_key, stats_counter_release);
+        stats_counter_active = 1;
+    }
+
     stats_event_time (NULL, "server_start", STATS_GENERAL);
 
     /* global currently active stats */
@@ -176,9 +289,14 @@ void stats_initialize(void)
     stats_event_flags (NULL, "source_total_connections", "0", STATS_COUNTERS);
     stats_event_flags (NULL, "stats_connections", "0", STATS_COUNTERS);
     stats_event_flags (NULL, "listener_connections", "0", STATS_COUNTERS);
+    stats_event_flags (NULL, "listener_affinity_placed", "0", STATS_COUNTERS);
+    stats_event_flags (NULL, "listener_affinity_spillover", "0", STATS_COUNTERS);
+    stats_event_flags (NULL, "listener_worker_moves", "0", STATS_COUNTERS);
     stats_event_flags (NULL, "outgoing_kbitrate", "0", STATS_COUNTERS|STATS_REGULAR);
     stats_event_flags (NULL, "stream_kbytes_sent", "0", STATS_COUNTERS|STATS_REGULAR);
     stats_event_flags (NULL, "stream_kbytes_read", "0", STATS_COUNTERS|STATS_REGULAR);
+    stats_event_flags (NULL, "worker_wakeups", "0", STATS_COUNTERS);
+    stats_event_flags (NULL, "worker_wakeups_coalesced", "0", STATS_COUNTERS);
 }
 
 void stats_shutdown(void)
@@ -191,6 +309,13 @@ void stats_shutdown(void)
     avl_tree_free(_stats.source_tree, _free_source_stats);
     avl_tree_free(_stats.global_tree, _free_stats);
     thread_mutex_destroy (&_stats.listeners_lock);
+    refbuf_release (_stats.xml_doc);
+    refbuf_release (_stats.xml_global);
+    _stats.xml_doc = _stats.xml_global = NULL;
+    thread_mutex_destroy (&_stats.xml_lock);
+    free (_stats.history);
+    _stats.history = NULL;
+    thread_mutex_destroy (&_stats.history_lock);
 }
 
 
@@ -279,8 +404,12 @@ static char *_get_stats(const char *source, const char *name)
     stats_node_t *stats = NULL;
     stats_source_t *src = NULL;
     char *value = NULL;
+    int i;
 
     if (source == NULL) {
+        for (i = 0; i < STATS_CTR_COUNT; i++)
+            if (strcmp (name, stats_counter_names [i]) == 0)
+                stats_counters_sync ();
         avl_tree_rlock (_stats.global_tree);
         stats = _find_node(_stats.global_tree, name);
         if (stats) value = (char *)strdup(stats->value);
@@ -290,7 +419,16 @@ static char *_get_stats(const char *source, const char *name)
         src = _find_source(_stats.source_tree, source);
         if (src)
         {
-            avl_tree_rlock (src->stats_tree);
+            for (i = 0; i < STATS_MOUNT_COUNT; i++)
+                if (strcmp (name, stats_mount_counter_names [i]) == 0)
+                    break;
+            if (i < STATS_MOUNT_COUNT)
+            {
+                avl_tree_wlock (src->stats_tree);
+                stats_mount_counters_sync (src);
+            }
+            else
+                avl_tree_rlock (src->stats_tree);
             avl_tree_unlock (_stats.source_tree);
             stats = _find_node(src->stats_tree, name);
             if (stats) value = (char *)strdup(stats->value);
@@ -313,13 +451,201 @@ char *stats_retrieve (long handle, const char *name)
 {
     char *v = NULL;
     stats_source_t *src_stats = (stats_source_t *)handle;
-    stats_node_t *stats = _find_node (src_stats->stats_tree, name);
+    stats_node_t *stats;
 
+    stats_mount_counters_sync (src_stats);
+    stats = _find_node (src_stats->stats_tree, name);
     if (stats) v =  strdup (stats->value);
     return v;
 }
 
 
+/* called on thread exit, keep what the thread counted */
+static void stats_counter_release (void *arg)
+{
+    struct stats_counter_cells *cells = arg, **p;
+    int i;
+
+    thread_mutex_lock (&stats_counter_lock);
+    for (p = &stats_counter_list; *p; p = &(*p)->next)
+    {
+        if (*p == cells)
+        {
+            *p = cells->next;
+            break;
+        }
+    }
+    for (i = 0; i < STATS_CTR_COUNT; i++)
+        stats_counter_retired [i] += cells->value [i];
+    thread_mutex_unlock (&stats_counter_lock);
+    free (cells);
+}
+
+
+void stats_counter_add (stats_counter_e counter, int64_t value)
+{
+    struct stats_counter_cells *cells;
+
+    if (stats_counter_active == 0)
+        return;
+    cells = pthread_getspecific (stats_counter_key);
+    if (cells == NULL)
+    {
+        cells = calloc (1, sizeof (*cells));
+        if (cells == NULL)
+            abort();
+        pthread_setspecific (stats_counter_key, cells);
+        thread_mutex_lock (&stats_counter_lock);
+        cells->next = stats_counter_list;
+        stats_counter_list = cells;
+        thread_mutex_unlock (&stats_counter_lock);
+    }
+    cells->value [counter] += value;
+}
+
+
+/* add up the global counters and update the tree with any that changed */
+static void stats_counters_sync (void)
+{
+    struct stats_counter_cells *cells;
+    int64_t total [STATS_CTR_COUNT];
+    int i;
+
+    if (stats_counter_active == 0)
+        return;
+    thread_mutex_lock (&stats_counter_lock);
+    memcpy (total, stats_counter_retired, sizeof (total));
+    for (cells = stats_counter_list; cells; cells = cells->next)
+        for (i = 0; i < STATS_CTR_COUNT; i++)
+            total [i] += cells->value [i];
+    thread_mutex_unlock (&stats_counter_lock);
+
+    avl_tree_wlock (_stats.global_tree);
+    for (i = 0; i < STATS_CTR_COUNT; i++)
+    {
+        stats_node_t *node;
+        char buffer [VAL_BUFSIZE];
+
+        if (total [i] == stats_counter_shown [i])
+            continue;
+        stats_counter_shown [i] = total [i];
+        _stats.global_generation++;
+        snprintf (buffer, VAL_BUFSIZE, "%" PRId64, total [i]);
+        node = _find_node (_stats.global_tree, stats_counter_names [i]);
+        if (node == NULL)
+        {
+            node = (stats_node_t *)calloc (1, sizeof(stats_node_t));
+            node->name = (char *)strdup (stats_counter_names [i]);
+            node->flags = STATS_COUNTERS;
+            avl_insert (_stats.global_tree, (void *)node);
+        }
+        free (node->value);
+        node->value = strdup (buffer);
+        if ((node->flags & STATS_REGULAR) == 0)
+            stats_listener_send (node->flags, "EVENT global %s %s\n", node->name, node->value);
+    }
+    avl_tree_unlock (_stats.global_tree);
+}
+
+
+/* mount counters are changed with atomic operations on the stats handle,
+ * so may be updated from any thread without the tree lock. Without a handle
+ * the update goes through as a normal event. */
+void stats_mount_counter_add (long handle, const char *mount, stats_mount_counter_e counter, int64_t value)
+{
+    stats_source_t *src_stats = (stats_source_t *)handle;
+
+    if (src_stats)
+        thread_atomic_add (&src_stats->counter [counter], value);
+    else if (value > 0)
+        stats_event_add (mount, stats_mount_counter_names [counter], value);
+    else if (value < 0)
+        stats_event_sub (mount, stats_mount_counter_names [counter], -value);
+}
+
+
+void stats_mount_counter_set (long handle, const char *mount, stats_mount_counter_e counter, int64_t value)
+{
+    stats_source_t *src_stats = (stats_source_t *)handle;
+
+    if (src_stats)
+        thread_atomic_swap (&src_stats->counter [counter], value);
+    else
+        stats_event_args (mount, (char *)stats_mount_counter_names [counter], "%" PRId64, value);
+}
+
+
+/* write any changed counters of a mount into its tree, which is write locked */
+static void stats_mount_counters_sync (stats_source_t *src_stats)
+{
+    int i;
+
+    for (i = 0; i < STATS_MOUNT_COUNT; i++)
+    {
+        stats_event_t event;
+        char buffer [VAL_BUFSIZE];
+        int64_t value = src_stats->counter [i];
+
+        if (value == src_stats->shown [i])
+            continue;
+        src_stats->shown [i] = value;
+        snprintf (buffer, VAL_BUFSIZE, "%" PRId64, value);
+        build_event (&event, src_stats->source, stats_mount_counter_names [i], buffer);
+        process_source_stat (src_stats, &event);
+    }
+}
+
+
+/* a counter stat being set directly, such as to 0 on a source starting,
+ * restarts the counter from that value */
+static void stats_mount_counter_reset (stats_source_t *src_stats, stats_event_t *event)
+{
+    int i;
+
+    if ((event->action & ~STATS_EVENT_HIDDEN) != STATS_EVENT_SET || event->name == NULL ||
+            event->value == NULL)
+        return;
+    for (i = 0; i < STATS_MOUNT_COUNT; i++)
+    {
+        if (strcmp (event->name, stats_mount_counter_names [i]) == 0)
+        {
+            int64_t value = atoll (event->value);
+            thread_atomic_swap (&src_stats->counter [i], value);
+            src_stats->shown [i] = value;
+            return;
+        }
+    }
+}
+
+
+/* bring all counters up to date in the trees before they are read */
+static void stats_sync_all (void)
+{
+    avl_node *node;
+
+    stats_counters_sync ();
+    avl_tree_rlock (_stats.source_tree);
+    node = avl_get_first (_stats.source_tree);
+    while (node)
+    {
+        stats_source_t *src_stats = (stats_source_t *)node->key;
+        int i;
+
+        for (i = 0; i < STATS_MOUNT_COUNT; i++)
+            if (src_stats->counter [i] != src_stats->shown [i])
+                break;
+        if (i < STATS_MOUNT_COUNT)
+        {
+            avl_tree_wlock (src_stats->stats_tree);
+            stats_mount_counters_sync (src_stats);
+            avl_tree_unlock (src_stats->stats_tree);
+        }
+        node = avl_get_next (node);
+    }
+    avl_tree_unlock (_stats.source_tree);
+}
+
+
 /* increase the value in the provided stat by 1 */
 void stats_event_inc(const char *source, const char *name)
 {
@@ -473,6 +799,7 @@ static void process_global_event (stats_event_t *event)
     stats_node_t *node = NULL;
 
     avl_tree_wlock (_stats.global_tree);
+    _stats.global_generation++;
     /* DEBUG3("global event %s %s %d", event->name, event->value, event->action); */
     if (event->action == STATS_EVENT_REMOVE)
     {
@@ -510,6 +837,7 @@ static void process_global_event (stats_event_t *event)
 
 static void process_source_stat (stats_source_t *src_stats, stats_event_t *event)
 {
+    src_stats->generation++;
     if (event->name)
     {
         stats_node_t *node = _find_node (src_stats->stats_tree, event->name);
@@ -609,8 +937,10 @@ static void process_source_event (stats_event_t *event)
         snode->source = (char *)strdup(event->source);
         snode->stats_tree = avl_tree_new(_compare_stats, NULL);
         snode->flags = STATS_SLAVE|STATS_GENERAL|STATS_HIDDEN;
+        snode->generation = 1;
 
         avl_insert(_stats.source_tree, (void *)snode);
+        _stats.sources_generation++;
     }
     if (event->action == STATS_EVENT_REMOVE && event->name == NULL)
     {
@@ -626,6 +956,7 @@ static void process_source_event (stats_event_t *event)
     }
     avl_tree_wlock (snode->stats_tree);
     avl_tree_unlock (_stats.source_tree);
+    stats_mount_counter_reset (snode, event);
     process_source_stat (snode, event);
     avl_tree_unlock (snode->stats_tree);
 }
@@ -650,6 +981,25 @@ void stats_event_time (const char *mount, const char *name, int flags)
 }
 
 
+/* drop a hold on a stats block, and on the blocks after it which were only
+ * held by the link to them. listeners lock is held */
+static void stats_block_release (refbuf_t *refbuf)
+{
+    while (refbuf)
+    {
+        refbuf_t *next = NULL;
+
+        if (refbuf->_count == 1)
+        {
+            next = refbuf->next;
+            refbuf->next = NULL;
+        }
+        refbuf_release (refbuf);
+        refbuf = next;
+    }
+}
+
+
 static int stats_listeners_send (client_t *client)
 {
     int loop = 8, total = 0;
@@ -660,16 +1010,21 @@ static int stats_listeners_send (client_t *client)
         return -1;
     if (client->refbuf && client->refbuf->flags & STATS_BLOCK_CONNECTION)
         loop = 4;
-    else
+    client->schedule_ms = client->worker->time_ms;
+    thread_mutex_lock (&_stats.listeners_lock);
+    if (listener->feed)
+    {
+        uint64_t lag = listener->queued + listener->feed->written - listener->feed_start - listener->sent;
+
         /* allow for 200k lag but only after 2Meg has been sent, give connection time
          * to cacth up after the large dump at the beginning */
-        if (client->connection.sent_bytes > 2000000 && listener->content_len > 200000)
+        if (client->connection.sent_bytes > 2000000 && lag > 200000)
         {
-            WARN1 ("dropping stats client, %ld in queue", listener->content_len);
+            thread_mutex_unlock (&_stats.listeners_lock);
+            WARN1 ("dropping stats client, %" PRIu64 " in queue", lag);
             return -1;
         }
-    client->schedule_ms = client->worker->time_ms;
-    thread_mutex_lock (&_stats.listeners_lock);
+    }
     while (1)
     {
         refbuf_t *refbuf = client->refbuf;
@@ -679,31 +1034,30 @@ static int stats_listeners_send (client_t *client)
             client->schedule_ms = client->worker->time_ms + 60;
             break;
         }
-        if (loop == 0 || total > 32768)
-            break;
-        ret = format_generic_write_to_client (client);
-        if (ret > 0)
-        {
-            total += ret;
-            listener->content_len -= ret;
-        }
         if (client->pos == refbuf->len)
         {
-            client->refbuf = refbuf->next;
-            refbuf->next = NULL;
-            refbuf_release (refbuf);
-            client->pos = 0;
-            if (client->refbuf == NULL)
+            if (refbuf->next == NULL)
             {
-                if (listener->content_len)
-                    WARN1 ("content length is %u", listener->content_len);
-                listener->recent_block = NULL;
+                /* caught up, check again for new events shortly */
                 client->schedule_ms = client->worker->time_ms + 50;
                 break;
             }
+            client->refbuf = refbuf->next;
+            refbuf_addref (client->refbuf);
+            stats_block_release (refbuf);
+            client->pos = 0;
             loop--;
+            continue;
         }
-        else
+        if (loop == 0 || total > 32768)
+            break;
+        ret = format_generic_write_to_client (client);
+        if (ret > 0)
+        {
+            total += ret;
+            listener->sent += ret;
+        }
+        if (client->pos < refbuf->len)
         {
             client->schedule_ms = client->worker->time_ms + 200;
             break; /* short write, so stop for now */
@@ -716,40 +1070,22 @@ static int stats_listeners_send (client_t *client)
 }
 
 
-static void clear_stats_queue (client_t *client)
-{
-    refbuf_t *refbuf = client->refbuf;
-    while (refbuf)
-    {
-        refbuf_t *to_go = refbuf;
-        refbuf = to_go->next;
-        if (to_go->_count != 1) DEBUG1 ("odd count for stats %d", to_go->_count);
-        to_go->next = NULL;
-        refbuf_release (to_go);
-    }
-    client->refbuf = NULL;
-}
-
-
 static void stats_listener_send (int mask, const char *fmt, ...)
 {
     va_list ap;
-    event_listener_t *listener;
+    stats_feed_t *feed;
 
     va_start(ap, fmt);
 
     thread_mutex_lock (&_stats.listeners_lock);
-    listener = _stats.event_listeners;
-
-    while (listener)
+    for (feed = _stats.feeds; feed; feed = feed->next)
     {
-        int admuser = listener->mask & STATS_HIDDEN,
+        int admuser = feed->mask & STATS_HIDDEN,
             hidden = mask & STATS_HIDDEN,
             flags = mask & ~STATS_HIDDEN;
 
-        if (admuser || (hidden == 0 && (flags & listener->mask)))
-            _add_stats_to_stats_client (listener->client, fmt, ap);
-        listener = listener->next;
+        if (admuser || (hidden == 0 && (flags & feed->mask)))
+            stats_feed_append (feed, fmt, ap);
     }
     thread_mutex_unlock (&_stats.listeners_lock);
     va_end(ap);
@@ -824,39 +1160,95 @@ static void _add_node_to_stats_client (client_t *client, refbuf_t *refbuf)
             listener->recent_block = refbuf;
             client->refbuf = refbuf;
         }
-        listener->content_len += refbuf->len;
+        listener->queued += refbuf->len;
     }
+    else
+        refbuf_release (refbuf);
 }
 
 
-static void _add_stats_to_stats_client (client_t *client, const char *fmt, va_list ap)
+/* start a new block at the end of the feed */
+static void stats_feed_extend (stats_feed_t *feed)
 {
-    event_listener_t *listener = client->shared_data;
-    refbuf_t *r = listener->recent_block;
+    refbuf_t *r = refbuf_new (STATS_BLOCK_SIZE), *old = feed->tail;
 
-    if (r && (r->flags & STATS_BLOCK_CONNECTION) == 0)
+    r->len = 0;
+    old->next = r;
+    refbuf_addref (r);
+    feed->tail = r;
+    stats_block_release (old);
+}
+
+
+static void stats_feed_append (stats_feed_t *feed, const char *fmt, va_list ap)
+{
+    int written;
+
+    /* lets see if we can append to the current block */
+    if (feed->tail->len < STATS_BLOCK_SIZE - 10)
     {
-        /* lets see if we can append to an existing block */
-        if (r->len < 1390)
+        written = _append_to_bufferv (feed->tail, STATS_BLOCK_SIZE, fmt, ap);
+        if (written > 0)
         {
-            int written = _append_to_bufferv (r, 1400, fmt, ap);
-            if (written > 0)
-            {
-                listener->content_len += written;
-                return;
-            }
+            feed->written += written;
+            return;
         }
     }
-    r = refbuf_new (1400);
-    r->len = 0;
-    if (_append_to_bufferv (r, 1400, fmt, ap) < 0)
+    if (feed->tail->len)
+        stats_feed_extend (feed);
+    written = _append_to_bufferv (feed->tail, STATS_BLOCK_SIZE, fmt, ap);
+    if (written < 0)
     {
         WARN1 ("stat details are too large \"%s\"", fmt);
-        refbuf_release (r);
         return;
     }
-    _add_node_to_stats_client (client, r);
-    client->schedule_ms = 0;
+    feed->written += written;
+}
+
+
+/* have the client continue from the end of its initial stats to the events
+ * that follow, on the feed for its mask. listeners lock is held */
+static void stats_feed_join (client_t *client)
+{
+    event_listener_t *listener = client->shared_data;
+    stats_feed_t *feed = _stats.feeds;
+
+    while (feed && feed->mask != listener->mask)
+        feed = feed->next;
+    if (feed == NULL)
+    {
+        feed = calloc (1, sizeof (stats_feed_t));
+        feed->mask = listener->mask;
+        feed->tail = refbuf_new (STATS_BLOCK_SIZE);
+        feed->tail->len = 0;
+        feed->next = _stats.feeds;
+        _stats.feeds = feed;
+    }
+    else if (feed->tail->len)
+        stats_feed_extend (feed);   /* others may have sent part of the current one */
+    feed->listeners++;
+    listener->recent_block->next = feed->tail;
+    refbuf_addref (feed->tail);
+    listener->recent_block = NULL;
+    listener->feed = feed;
+    listener->feed_start = feed->written;
+}
+
+
+static void stats_feed_leave (client_t *client)
+{
+    event_listener_t *listener = client->shared_data;
+    stats_feed_t *feed = listener->feed, **trail = &_stats.feeds;
+
+    stats_block_release (client->refbuf);
+    client->refbuf = NULL;
+    if (feed == NULL || --feed->listeners)
+        return;
+    while (*trail != feed)
+        trail = &(*trail)->next;
+    *trail = feed->next;
+    stats_block_release (feed->tail);
+    free (feed);
 }
 
 
@@ -924,6 +1316,7 @@ static void _register_listener (client_t *client)
     build_event (&stats_count, NULL, "stats_connections", buffer);
     stats_count.action = STATS_EVENT_INC;
     process_event (&stats_count);
+    stats_sync_all ();
 
     /* first we fill our queue with the current stats */
     refbuf = refbuf_new (size);
@@ -1010,42 +1403,26 @@ static void _register_listener (client_t *client)
 
     /* now we register to receive future event notices */
     thread_mutex_lock (&_stats.listeners_lock);
-    listener->next = _stats.event_listeners;
-    _stats.event_listeners = listener;
+    stats_feed_join (client);
     thread_mutex_unlock (&_stats.listeners_lock);
 }
 
 
 static void stats_client_release (client_t *client)
 {
-    event_listener_t *listener, **trail;
+    event_listener_t *listener = client->shared_data;
+    stats_event_t stats_count;
+    char buffer [20];
 
     thread_mutex_lock (&_stats.listeners_lock);
-    listener = _stats.event_listeners;
-    trail = &_stats.event_listeners;
-
-    while (listener)
-    {
-        if (listener == client->shared_data)
-        {
-            stats_event_t stats_count;
-            char buffer [20];
-
-            *trail = listener->next;
-            thread_mutex_unlock (&_stats.listeners_lock);
-            clear_stats_queue (client);
-            free (listener->source);
-            free (listener);
-            client_destroy (client);
-            build_event (&stats_count, NULL, "stats_connections", buffer);
-            stats_count.action = STATS_EVENT_DEC;
-            process_event (&stats_count);
-            return;
-        }
-        trail = &listener->next;
-        listener = listener->next;
-    }
+    stats_feed_leave (client);
     thread_mutex_unlock (&_stats.listeners_lock);
+    free (listener->source);
+    free (listener);
+    client_destroy (client);
+    build_event (&stats_count, NULL, "stats_connections", buffer);
+    stats_count.action = STATS_EVENT_DEC;
+    process_event (&stats_count);
 }
 
 
@@ -1068,9 +1445,8 @@ void stats_add_listener (client_t *client, int mask)
     snprintf (client->refbuf->data, 100,
             "HTTP/1.0 200 OK\r\nCapability: streamlist stats\r\n\r\n");
     client->refbuf->len = strlen (client->refbuf->data);
-    listener->content_len = client->refbuf->len;
+    listener->queued = client->refbuf->len;
     listener->recent_block = client->refbuf;
-    listener->client = client;
 
     _register_listener (client);
     client->flags |= CLIENT_ACTIVE;
@@ -1095,11 +1471,197 @@ int stats_transform_xslt (client_t *client, const char *uri)
     return ret;
 }
 
+/* append to a block, where size is the space allocated for it */
+static void _xml_append (refbuf_t *r, unsigned int *size, const char *s, unsigned int len)
+{
+    if (r->len + len >= *size)
+    {
+        unsigned int used = r->len;
+
+        while (used + len >= *size)
+            *size *= 2;
+        refbuf_expand (r, *size);
+        r->len = used;
+    }
+    memcpy (r->data + r->len, s, len);
+    r->len += len;
+}
+
+
+/* append text escaped the same way as libxml2 does when saving a document
+ * without an encoding, so content and attributes match xmlNewTextChild and
+ * xmlSetProp output */
+static void _xml_append_escaped (refbuf_t *r, unsigned int *size, const char *str, int attr)
+{
+    const unsigned char *p = (const unsigned char *)str;
+
+    while (*p)
+    {
+        const unsigned char *start = p;
+        char ref [16];
+        const char *rep = ref;
+        unsigned int c = *p;
+
+        while (*p >= 0x20 && *p < 0x80 && *p != '&' && *p != '<' && *p != '>' && (attr == 0 || *p != '"'))
+            p++;
+        if (p > start)
+        {
+            _xml_append (r, size, (const char *)start, p - start);
+            continue;
+        }
+        c = *p++;
+        if (c == '&')       rep = "&amp;";
+        else if (c == '<')  rep = "&lt;";
+        else if (c == '>')  rep = "&gt;";
+        else if (c == '"')  rep = "&quot;";
+        else if (c == '\r')
+            rep = attr ? "&#13;" : "&#xD;";
+        else if (c < 0x20)
+        {
+            if (attr)
+                snprintf (ref, sizeof ref, "&#%u;", c);
+            else
+                ref [0] = c, ref [1] = '\0';
+        }
+        else
+        {
+            /* non-ascii is written as a character reference */
+            int extra = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : 0;
+
+            if (extra)
+                c &= (0x3F >> extra);
+            for (; extra && (*p & 0xC0) == 0x80; extra--)
+                c = (c << 6) | (*p++ & 0x3F);
+            snprintf (ref, sizeof ref, "&#x%X;", c);
+        }
+        _xml_append (r, size, rep, strlen (rep));
+    }
+}
+
+
+static void _xml_append_stat (refbuf_t *r, unsigned int *size, const char *indent, stats_node_t *stat)
+{
+    _xml_append (r, size, indent, strlen (indent));
+    _xml_append (r, size, "<", 1);
+    _xml_append (r, size, stat->name, strlen (stat->name));
+    _xml_append (r, size, ">", 1);
+    _xml_append_escaped (r, size, stat->value, 0);
+    _xml_append (r, size, "</", 2);
+    _xml_append (r, size, stat->name, strlen (stat->name));
+    _xml_append (r, size, ">\n", 2);
+}
+
+
+/* xml for one source, with its stats tree locked */
+static refbuf_t *_stats_source_xml (stats_source_t *src_stats)
+{
+    unsigned int size = 1024;
+    refbuf_t *r = refbuf_new (size);
+    avl_node *node = avl_get_first (src_stats->stats_tree);
+
+    r->len = 0;
+    _xml_append (r, &size, "  <source mount=\"", 17);
+    _xml_append_escaped (r, &size, src_stats->source, 1);
+    if (node == NULL)
+    {
+        _xml_append (r, &size, "\"/>\n", 4);
+        return r;
+    }
+    _xml_append (r, &size, "\">\n", 3);
+    for (; node; node = avl_get_next (node))
+        _xml_append_stat (r, &size, "    ", node->key);
+    _xml_append (r, &size, "  </source>\n", 12);
+    return r;
+}
+
+
+/* Return the serialised xml of all the stats, as stats_get_xml (STATS_ALL, NULL)
+ * would give. The result is kept and handed out again until something changes,
+ * and then only the global part or sources that changed are redone. The block
+ * returned is shared so must not be changed, just released when finished with.
+ */
+refbuf_t *stats_get_xml_cached (void)
+{
+    refbuf_t *doc;
+    avl_node *node;
+    int changed = 0;
+
+    stats_sync_all ();
+    thread_mutex_lock (&_stats.xml_lock);
+    avl_tree_rlock (_stats.global_tree);
+    if (_stats.xml_global == NULL || _stats.xml_global_generation != _stats.global_generation)
+    {
+        unsigned int size = 4096;
+        refbuf_t *r = refbuf_new (size);
+
+        r->len = 0;
+        for (node = avl_get_first (_stats.global_tree); node; node = avl_get_next (node))
+        {
+            stats_node_t *stat = node->key;
+            if (stat->flags & STATS_ALL)
+                _xml_append_stat (r, &size, "  ", stat);
+        }
+        refbuf_release (_stats.xml_global);
+        _stats.xml_global = r;
+        _stats.xml_global_generation = _stats.global_generation;
+        changed = 1;
+    }
+    avl_tree_unlock (_stats.global_tree);
+
+    avl_tree_rlock (_stats.source_tree);
+    if (_stats.xml_sources_generation != _stats.sources_generation)
+    {
+        _stats.xml_sources_generation = _stats.sources_generation;
+        changed = 1;
+    }
+    for (node = avl_get_first (_stats.source_tree); node; node = avl_get_next (node))
+    {
+        stats_source_t *src_stats = node->key;
+
+        avl_tree_rlock (src_stats->stats_tree);
+        if (src_stats->xml == NULL || src_stats->xml_generation != src_stats->generation)
+        {
+            refbuf_release (src_stats->xml);
+            src_stats->xml = _stats_source_xml (src_stats);
+            src_stats->xml_generation = src_stats->generation;
+            changed = 1;
+        }
+        avl_tree_unlock (src_stats->stats_tree);
+    }
+    if (changed || _stats.xml_doc == NULL)
+    {
+        unsigned int size = _stats.xml_global->len + 64;
+        refbuf_t *r;
+
+        for (node = avl_get_first (_stats.source_tree); node; node = avl_get_next (node))
+            size += ((stats_source_t *)node->key)->xml->len;
+        r = refbuf_new (size);
+        r->len = 0;
+        _xml_append (r, &size, "<?xml version=\"1.0\"?>\n<icestats>\n", 33);
+        _xml_append (r, &size, _stats.xml_global->data, _stats.xml_global->len);
+        for (node = avl_get_first (_stats.source_tree); node; node = avl_get_next (node))
+        {
+            refbuf_t *xml = ((stats_source_t *)node->key)->xml;
+            _xml_append (r, &size, xml->data, xml->len);
+        }
+        _xml_append (r, &size, "</icestats>\n", 12);
+        refbuf_release (_stats.xml_doc);
+        _stats.xml_doc = r;
+    }
+    avl_tree_unlock (_stats.source_tree);
+    doc = _stats.xml_doc;
+    refbuf_addref (doc);
+    thread_mutex_unlock (&_stats.xml_lock);
+    return doc;
+}
+
+
 xmlDocPtr stats_get_xml (int flags, const char *show_mount)
 {
     xmlDocPtr doc;
     xmlNodePtr node;
 
+    stats_sync_all ();
     doc = xmlNewDoc (XMLSTR("1.0"));
     node = xmlNewDocNode (doc, NULL, XMLSTR("icestats"), NULL);
     xmlDocSetRootElement(doc, node);
@@ -1136,6 +1698,121 @@ xmlDocPtr stats_get_xml (int flags, const char *show_mount)
     return doc;
 }
 
+/* the same stats as stats_get_xml (STATS_ALL, show_mount) gives, written
+ * straight from the trees as JSON. Values that are numbers are written as
+ * numbers, and a mount requested also has its listeners listed */
+/* the per mount stats that are always numbers, anything else is sent as text */
+static int _stats_mount_numeric (const char *name)
+{
+    static const char *names[] =
+    {
+        "audio_bitrate", "audio_channels", "audio_samplerate", "connected",
+        "ice-bitrate", "ice-channels", "ice-samplerate", "incoming_bitrate",
+        "listener_connections", "listener_peak", "listeners", "outgoing_kbitrate",
+        "queue_size", "slow_listeners", "total_bytes_read", "total_bytes_sent",
+        "total_mbytes_sent", "video_bitrate", NULL
+    };
+    int i;
+
+    for (i = 0; names[i]; i++)
+        if (strcmp (names[i], name) == 0)
+            return 1;
+    return 0;
+}
+
+
+refbuf_t *stats_get_json (const char *show_mount)
+{
+    json_t json;
+    refbuf_t *r;
+    avl_node *node;
+    int shown = 0;
+
+    stats_sync_all ();
+    json_init (&json, 8192);
+    json_start_object (&json, NULL);
+    json_start_object (&json, "icestats");
+
+    avl_tree_rlock (_stats.global_tree);
+    for (node = avl_get_first (_stats.global_tree); node; node = avl_get_next (node))
+    {
+        stats_node_t *stat = node->key;
+        if (stat->flags & STATS_COUNTERS)
+            json_add_number (&json, stat->name, stat->value);
+        else
+            json_add_string (&json, stat->name, stat->value);
+    }
+    avl_tree_unlock (_stats.global_tree);
+
+    json_start_array (&json, "source");
+    avl_tree_rlock (_stats.source_tree);
+    for (node = avl_get_first (_stats.source_tree); node; node = avl_get_next (node))
+    {
+        stats_source_t *src_stats = node->key;
+        avl_node *snode;
+
+        if (show_mount && strcmp (show_mount, src_stats->source) != 0)
+            continue;
+        json_start_object (&json, NULL);
+        json_add_string (&json, "mount", src_stats->source);
+        avl_tree_rlock (src_stats->stats_tree);
+        for (snode = avl_get_first (src_stats->stats_tree); snode; snode = avl_get_next (snode))
+        {
+            stats_node_t *stat = snode->key;
+            if (_stats_mount_numeric (stat->name))
+                json_add_number (&json, stat->name, stat->value);
+            else
+                json_add_string (&json, stat->name, stat->value);
+        }
+        avl_tree_unlock (src_stats->stats_tree);
+        shown = 1;
+        if (show_mount)
+            break;
+        json_end_object (&json);
+    }
+    avl_tree_unlock (_stats.source_tree);
+
+    if (show_mount && shown)
+    {
+        source_t *source;
+
+        /* the listeners go in the mount object, still open */
+        json_start_array (&json, "listener");
+        avl_tree_rlock (global.source_tree);
+        source = source_find_mount_raw (show_mount);
+        if (source)
+        {
+            thread_rwlock_rlock (&source->lock);
+            for (node = avl_get_first (source->clients); node; node = avl_get_next (node))
+                stats_listener_to_json (node->key, &json);
+            thread_rwlock_unlock (&source->lock);
+            avl_tree_unlock (global.source_tree);
+        }
+        else
+        {
+            fbinfo finfo;
+
+            avl_tree_unlock (global.source_tree);
+            finfo.flags = FS_FALLBACK;
+            finfo.mount = (char*)show_mount;
+            finfo.limit = 0;
+            finfo.fallback = NULL;
+
+            fserve_list_clients_json (&json, &finfo);
+        }
+        json_end_array (&json);
+        json_end_object (&json);
+    }
+    json_end_array (&json);
+    json_end_object (&json);
+    json_end_object (&json);
+
+    r = refbuf_new (0);
+    r->data = json_finish (&json, &r->len);
+    return r;
+}
+
+
 static int _compare_stats(void *arg, void *a, void *b)
 {
     stats_node_t *nodea = (stats_node_t *)a;
@@ -1169,8 +1846,11 @@ static int _free_source_stats(void *key)
     DEBUG1 ("delete source node %s", node->source);
     avl_tree_unlock (node->stats_tree);
     avl_tree_free(node->stats_tree, _free_stats);
+    refbuf_release (node->xml);
+    free (node->history);
     free(node->source);
     free(node);
+    _stats.sources_generation++;
 
     return 1;
 }
@@ -1263,6 +1943,218 @@ void stats_clear_virtual_mounts (void)
 }
 
 
+static uint32_t _history_value (avl_tree *tree, const char *name)
+{
+    stats_node_t *node = _find_node (tree, name);
+    return node ? (uint32_t)strtoul (node->value, NULL, 10) : 0;
+}
+
+
+static void _history_add (stats_history_t *h, time_t now, const stats_sample_t *sample)
+{
+    if (h->last)
+    {
+        time_t t = h->last + 1;
+
+        if (now <= h->last)
+            return;
+        /* any seconds missed keep the previous figures */
+        if (now - t > STATS_HISTORY_SECONDS)
+            t = now - STATS_HISTORY_SECONDS;
+        for (; t < now; t++)
+            h->second [t % STATS_HISTORY_SECONDS] = h->second [h->last % STATS_HISTORY_SECONDS];
+        if (now / 60 != h->last / 60)
+        {
+            stats_sample_t avg;
+            time_t m = h->last / 60;
+
+            avg.listeners = h->sum.listeners / h->sum_count;
+            avg.slow_listeners = h->sum.slow_listeners / h->sum_count;
+            avg.in_kbitrate = h->sum.in_kbitrate / h->sum_count;
+            avg.out_kbitrate = h->sum.out_kbitrate / h->sum_count;
+            avg.connections = h->sum.connections;
+            if (now / 60 - m > STATS_HISTORY_MINUTES)
+                m = now / 60 - STATS_HISTORY_MINUTES;
+            for (; m < now / 60; m++)
+                h->minute [m % STATS_HISTORY_MINUTES] = avg;
+            memset (&h->sum, 0, sizeof (h->sum));
+            h->sum_count = 0;
+        }
+    }
+    else
+        h->first = now;
+    h->second [now % STATS_HISTORY_SECONDS] = *sample;
+    h->last = now;
+    h->sum.listeners += sample->listeners;
+    h->sum.slow_listeners += sample->slow_listeners;
+    h->sum.in_kbitrate += sample->in_kbitrate;
+    h->sum.out_kbitrate += sample->out_kbitrate;
+    h->sum.connections = sample->connections;
+    h->sum_count++;
+}
+
+
+static void _history_sample_mount (stats_source_t *src_stats, time_t now, stats_sample_t *total)
+{
+    stats_sample_t sample;
+
+    avl_tree_rlock (src_stats->stats_tree);
+    sample.listeners = _history_value (src_stats->stats_tree, "listeners");
+    sample.slow_listeners = _history_value (src_stats->stats_tree, "slow_listeners");
+    sample.connections = _history_value (src_stats->stats_tree, "listener_connections");
+    avl_tree_unlock (src_stats->stats_tree);
+
+    thread_mutex_lock (&_stats.history_lock);
+    sample.in_kbitrate = src_stats->in_kbitrate;
+    sample.out_kbitrate = src_stats->out_kbitrate;
+    src_stats->in_kbitrate = src_stats->out_kbitrate = 0;
+    if (src_stats->history == NULL)
+    {
+        src_stats->history = calloc (1, sizeof (stats_history_t));
+        if (src_stats->history == NULL)
+            abort();
+    }
+    _history_add (src_stats->history, now, &sample);
+    thread_mutex_unlock (&_stats.history_lock);
+
+    total->slow_listeners += sample.slow_listeners;
+    total->in_kbitrate += sample.in_kbitrate;
+}
+
+
+/* take the 1 second samples for each mount and the server as a whole */
+static void stats_history_sample (time_t now)
+{
+    stats_sample_t total;
+    avl_node *node;
+
+    /* the bitrates of running sources */
+    avl_tree_rlock (global.source_tree);
+    for (node = avl_get_first (global.source_tree); node; node = avl_get_next (node))
+    {
+        source_t *source = node->key;
+
+        thread_rwlock_rlock (&source->lock);
+        if (source->stats)
+        {
+            stats_source_t *src_stats = (stats_source_t *)source->stats;
+
+            thread_mutex_lock (&_stats.history_lock);
+            src_stats->in_kbitrate = (uint32_t)(8 * rate_avg (source->in_bitrate) / 1024);
+            src_stats->out_kbitrate = (uint32_t)(8 * rate_avg (source->out_bitrate) / 1024);
+            thread_mutex_unlock (&_stats.history_lock);
+        }
+        thread_rwlock_unlock (&source->lock);
+    }
+    avl_tree_unlock (global.source_tree);
+
+    memset (&total, 0, sizeof (total));
+    avl_tree_rlock (_stats.source_tree);
+    for (node = avl_get_first (_stats.source_tree); node; node = avl_get_next (node))
+        _history_sample_mount (node->key, now, &total);
+    avl_tree_unlock (_stats.source_tree);
+
+    avl_tree_rlock (_stats.global_tree);
+    total.listeners = _history_value (_stats.global_tree, "listeners");
+    total.connections = _history_value (_stats.global_tree, "listener_connections");
+    total.out_kbitrate = _history_value (_stats.global_tree, "outgoing_kbitrate");
+    avl_tree_unlock (_stats.global_tree);
+
+    thread_mutex_lock (&_stats.history_lock);
+    if (_stats.history == NULL)
+    {
+        _stats.history = calloc (1, sizeof (stats_history_t));
+        if (_stats.history == NULL)
+            abort();
+    }
+    _history_add (_stats.history, now, &total);
+    thread_mutex_unlock (&_stats.history_lock);
+}
+
+
+/* Return the history for a mount, or the whole server if mount is NULL, as
+ * JSON with an array for each figure. interval is 1 or 60 for the second or
+ * minute samples, and only samples after since are given. NULL is returned
+ * if there is no such mount.
+ */
+refbuf_t *stats_get_history (const char *mount, int interval, time_t since)
+{
+    static const char *names[] = { "listeners", "slow_listeners", "in_kbitrate", "out_kbitrate", "listener_connections" };
+    stats_source_t *src_stats = NULL;
+    stats_history_t *h;
+    stats_sample_t *ring;
+    time_t start, end, t;
+    unsigned int size;
+    json_t json;
+    refbuf_t *r;
+    int i;
+
+    avl_tree_rlock (_stats.source_tree);
+    if (mount)
+    {
+        src_stats = _find_source (_stats.source_tree, mount);
+        if (src_stats == NULL)
+        {
+            avl_tree_unlock (_stats.source_tree);
+            return NULL;
+        }
+    }
+    thread_mutex_lock (&_stats.history_lock);
+    h = src_stats ? src_stats->history : _stats.history;
+    if (interval == 60)
+    {
+        ring = h ? h->minute : NULL;
+        size = STATS_HISTORY_MINUTES;
+        start = h ? h->first / 60 : 0;
+        end = h ? h->last / 60 : 0;    /* the current minute is not complete */
+    }
+    else
+    {
+        interval = 1;
+        ring = h ? h->second : NULL;
+        size = STATS_HISTORY_SECONDS;
+        start = h ? h->first : 0;
+        end = h ? h->last + 1 : 0;
+    }
+    if (end - start > size)
+        start = end - size;
+    if (since / interval >= start)
+        start = since / interval + 1;
+    if (start > end)
+        start = end;
+
+    json_init (&json, 1024 + (end - start) * 5 * 6);
+    json_start_object (&json, NULL);
+    json_add_string (&json, "mount", mount);
+    json_add_int (&json, "interval", interval);
+    json_add_int (&json, "start", (int64_t)start * interval);
+    for (i = 0; i < 5; i++)
+    {
+        json_start_array (&json, names [i]);
+        for (t = start; t < end; t++)
+        {
+            stats_sample_t *sample = &ring [t % size];
+            switch (i)
+            {
+                case 0: json_add_int (&json, NULL, sample->listeners); break;
+                case 1: json_add_int (&json, NULL, sample->slow_listeners); break;
+                case 2: json_add_int (&json, NULL, sample->in_kbitrate); break;
+                case 3: json_add_int (&json, NULL, sample->out_kbitrate); break;
+                case 4: json_add_int (&json, NULL, (int64_t)sample->connections); break;
+            }
+        }
+        json_end_array (&json);
+    }
+    json_end_object (&json);
+    thread_mutex_unlock (&_stats.history_lock);
+    avl_tree_unlock (_stats.source_tree);
+
+    r = refbuf_new (0);
+    r->data = json_finish (&json, &r->len);
+    return r;
+}
+
+
 void stats_global_calc (void)
 {
     stats_event_t event;
@@ -1270,6 +2162,10 @@ void stats_global_calc (void)
     char buffer [VAL_BUFSIZE];
 
     connection_stats ();
+    workers_stats ();
+    refbuf_stats ();
+    fserve_stats ();
+    stats_sync_all ();
     avl_tree_rlock (_stats.global_tree);
     anode = avl_get_first(_stats.global_tree);
     while (anode)
@@ -1287,6 +2183,7 @@ void stats_global_calc (void)
     snprintf (buffer, sizeof(buffer), "%" PRIu64,
             (int64_t)global_getrate_avg (global.out_bitrate) * 8 / 1024);
     process_event (&event);
+    stats_history_sample (time (NULL));
 }
 
 
@@ -1307,8 +2204,10 @@ long stats_handle (const char *mount)
         src_stats->source = (char *)strdup (mount);
         src_stats->stats_tree = avl_tree_new (_compare_stats, NULL);
         src_stats->flags = STATS_SLAVE|STATS_GENERAL|STATS_HIDDEN;
+        src_stats->generation = 1;
 
         avl_insert (_stats.source_tree, (void *)src_stats);
+        _stats.sources_generation++;
     }
     avl_tree_wlock (src_stats->stats_tree);
     avl_tree_unlock (_stats.source_tree);
@@ -1346,6 +2245,7 @@ void stats_flush (long handle)
         avl_node *node;
 
         avl_tree_wlock (src_stats->stats_tree);
+        src_stats->generation++;
         while ((node = src_stats->stats_tree->root->right))
         {
             stats_node_t *stats = (stats_node_t*)node->key;
@@ -1367,6 +2267,7 @@ void stats_set (long handle, const char *name, const char *value)
         stats_event_t event;
 
         build_event (&event, src_stats->source, name, (char *)value);
+        stats_mount_counter_reset (src_stats, &event);
         process_source_stat (src_stats, &event);
     }
 }
@@ -1406,6 +2307,7 @@ void stats_set_flags (long handle, const char *name, const char *value, int flag
         event.action |= STATS_EVENT_HIDDEN;
     else
         event.action = STATS_EVENT_HIDDEN;
+    stats_mount_counter_reset (src_stats, &event);
     process_source_stat (src_stats, &event);
 }
 
@@ -1470,6 +2372,35 @@ void stats_set_conv (long handle, const char *name, const char *value, const cha
 }
 
 
+void stats_listener_to_json (client_t *listener, json_t *json)
+{
+    const char *useragent;
+    uint64_t lag = 0;
+
+    json_start_object (json, NULL);
+    json_add_int (json, "id", (int64_t)listener->connection.id);
+    json_add_string (json, "IP", listener->connection.ip);
+
+    useragent = httpp_getvar (listener->parser, "user-agent");
+    if (useragent)
+        json_add_string (json, "UserAgent", useragent);
+
+    if ((listener->flags & (CLIENT_ACTIVE|CLIENT_IN_FSERVE)) == CLIENT_ACTIVE)
+    {
+        source_t *source = listener->shared_data;
+        lag = source->client->queue_pos - listener->queue_pos;
+    }
+    json_add_int (json, "lag", (int64_t)lag);
+
+    if (listener->worker)
+        json_add_int (json, "Connected",
+                (int64_t)(listener->worker->current_time.tv_sec - listener->connection.con_time));
+    if (listener->username)
+        json_add_string (json, "username", listener->username);
+    json_end_object (json);
+}
+
+
 void stats_listener_to_xml (client_t *listener, xmlNodePtr parent)
 {
     const char *useragent;
@@ -17,6 +17,7 @@
 #include "connection.h"
 #include "httpp/httpp.h"
 #include "client.h"
+#include "json.h"
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -29,6 +30,35 @@
 #define STATS_REGULAR   01000
 #define STATS_ALL      ~0
 
+/* numeric global stats, counted per thread and added up when read */
+typedef enum
+{
+    STATS_CTR_CLIENTS,
+    STATS_CTR_CONNECTIONS,
+    STATS_CTR_LISTENERS,
+    STATS_CTR_CLIENT_CONNECTIONS,
+    STATS_CTR_LISTENER_CONNECTIONS,
+    STATS_CTR_SOURCE_CLIENT_CONNECTIONS,
+    STATS_CTR_SOURCE_RELAY_CONNECTIONS,
+    STATS_CTR_SOURCE_TOTAL_CONNECTIONS,
+    STATS_CTR_FILE_CONNECTIONS,
+    STATS_CTR_STREAM_KBYTES_SENT,
+    STATS_CTR_STREAM_KBYTES_READ,
+    STATS_CTR_AFFINITY_PLACED,
+    STATS_CTR_AFFINITY_SPILLOVER,
+    STATS_CTR_WORKER_MOVES,
+    STATS_CTR_COUNT
+} stats_counter_e;
+
+/* numeric per mount stats, updated without taking the stats locks */
+typedef enum
+{
+    STATS_MOUNT_LISTENERS,
+    STATS_MOUNT_LISTENER_CONNECTIONS,
+    STATS_MOUNT_SLOW_LISTENERS,
+    STATS_MOUNT_COUNT
+} stats_mount_counter_e;
+
 void stats_initialize(void);
 void stats_shutdown(void);
 
@@ -48,6 +78,12 @@ void stats_event_dec(const char *source, const char *name);
 void stats_event_flags (const char *source, const char *name, const char *value, int flags);
 void stats_event_time (const char *mount, const char *name, int flags);
 
+void stats_counter_add (stats_counter_e counter, int64_t value);
+#define stats_counter_inc(c)    stats_counter_add(c,1)
+#define stats_counter_dec(c)    stats_counter_add(c,-1)
+void stats_mount_counter_add (long handle, const char *mount, stats_mount_counter_e counter, int64_t value);
+void stats_mount_counter_set (long handle, const char *mount, stats_mount_counter_e counter, int64_t value);
+
 void *stats_connection(void *arg);
 void stats_add_listener (client_t *client, int hidden_level);
 void stats_global_calc(void);
@@ -55,6 +91,9 @@ void stats_global_calc(void);
 int  stats_transform_xslt(client_t *client, const char *uri);
 void stats_sendxml(client_t *client);
 xmlDocPtr stats_get_xml(int flags, const char *show_mount);
+refbuf_t *stats_get_xml_cached (void);
+refbuf_t *stats_get_json (const char *show_mount);
+refbuf_t *stats_get_history (const char *mount, int interval, time_t since);
 char *stats_get_value(const char *source, const char *name);
 
 long stats_handle (const char *mount);
@@ -69,6 +108,7 @@ void stats_set_time (long handle, const char *name, int flags, time_t tm);
 char *stats_retrieve (long handle, const char *name);
 
 void stats_listener_to_xml (client_t *listener, xmlNodePtr parent);
+void stats_listener_to_json (client_t *listener, json_t *json);
 
 #endif  /* __STATS_H__ */
 
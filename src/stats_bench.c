@@ -0,0 +1,223 @@
+/* stats_bench.c
+**
+** compare producing JSON stats with the json writer, as /admin/stats.json
+** does, against the previous route of building the XML document, as
+** stats_get_xml does, and applying a stylesheet that outputs JSON to it.
+** The plain XML dump, as /admin/stats.xml did before caching, is shown too.
+**
+** built from src after configure, which creates config.h at the top
+** cc -O2 -DHAVE_CONFIG_H -I.. -I/usr/include/libxml2 stats_bench.c json.c -lxslt -lxml2
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <libxml/tree.h>
+#include <libxslt/xslt.h>
+#include <libxslt/xsltInternals.h>
+#include <libxslt/transform.h>
+#include <libxslt/xsltutils.h>
+
+#include "json.h"
+
+#define LOOPS           2000
+#define GLOBAL_STATS    60
+#define MOUNTS          20
+#define MOUNT_STATS     30
+#define LISTENERS       50
+
+static const char *stylesheet =
+    "<xsl:stylesheet xmlns:xsl=\"http://www.w3.org/1999/XSL/Transform\" version=\"1.0\">\n"
+    "<xsl:output method=\"text\" encoding=\"UTF-8\"/>\n"
+    "<xsl:template name=\"str\"><xsl:param name=\"s\"/>"
+    "<xsl:choose><xsl:when test=\"contains($s,'&quot;')\">"
+    "<xsl:value-of select=\"substring-before($s,'&quot;')\"/>\\&quot;"
+    "<xsl:call-template name=\"str\"><xsl:with-param name=\"s\" select=\"substring-after($s,'&quot;')\"/></xsl:call-template>"
+    "</xsl:when><xsl:otherwise><xsl:value-of select=\"$s\"/></xsl:otherwise></xsl:choose></xsl:template>\n"
+    "<xsl:template name=\"val\">\"<xsl:value-of select=\"name()\"/>\":"
+    "<xsl:choose><xsl:when test=\"string(number(.))!='NaN'\"><xsl:value-of select=\".\"/></xsl:when>"
+    "<xsl:otherwise>\"<xsl:call-template name=\"str\"><xsl:with-param name=\"s\" select=\".\"/></xsl:call-template>\"</xsl:otherwise>"
+    "</xsl:choose><xsl:if test=\"position()!=last()\">,</xsl:if></xsl:template>\n"
+    "<xsl:template match=\"/icestats\">{\"icestats\":{"
+    "<xsl:for-each select=\"*[name()!='source']\"><xsl:call-template name=\"val\"/></xsl:for-each>"
+    ",\"source\":[<xsl:for-each select=\"source\">{\"mount\":\"<xsl:value-of select=\"@mount\"/>\","
+    "<xsl:for-each select=\"*[name()!='listener']\"><xsl:call-template name=\"val\"/></xsl:for-each>"
+    "<xsl:if test=\"listener\">,\"listener\":[<xsl:for-each select=\"listener\">{\"id\":<xsl:value-of select=\"@id\"/>,"
+    "<xsl:for-each select=\"*\"><xsl:call-template name=\"val\"/></xsl:for-each>}"
+    "<xsl:if test=\"position()!=last()\">,</xsl:if></xsl:for-each>]</xsl:if>}"
+    "<xsl:if test=\"position()!=last()\">,</xsl:if></xsl:for-each>]}}</xsl:template>\n"
+    "</xsl:stylesheet>\n";
+
+
+static char names [GLOBAL_STATS + MOUNT_STATS][32], values [GLOBAL_STATS + MOUNT_STATS][64];
+
+static void setup (void)
+{
+    int i;
+    for (i = 0; i < GLOBAL_STATS + MOUNT_STATS; i++)
+    {
+        snprintf (names[i], sizeof names[i], "stat_name_%02d", i);
+        if (i % 3)
+            snprintf (values[i], sizeof values[i], "%d", i * 1234);
+        else
+            snprintf (values[i], sizeof values[i], "Some \"text\" value number %d", i);
+    }
+}
+
+
+static xmlDocPtr build_doc (void)
+{
+    xmlDocPtr doc = xmlNewDoc (BAD_CAST "1.0");
+    xmlNodePtr root = xmlNewDocNode (doc, NULL, BAD_CAST "icestats", NULL);
+    int i, m, l;
+    char buf [30];
+
+    xmlDocSetRootElement (doc, root);
+    for (i = 0; i < GLOBAL_STATS; i++)
+        xmlNewTextChild (root, NULL, BAD_CAST names[i], BAD_CAST values[i]);
+    for (m = 0; m < MOUNTS; m++)
+    {
+        xmlNodePtr src = xmlNewTextChild (root, NULL, BAD_CAST "source", NULL);
+        snprintf (buf, sizeof buf, "/mount%02d.ogg", m);
+        xmlSetProp (src, BAD_CAST "mount", BAD_CAST buf);
+        for (i = GLOBAL_STATS; i < GLOBAL_STATS + MOUNT_STATS; i++)
+            xmlNewTextChild (src, NULL, BAD_CAST names[i], BAD_CAST values[i]);
+        for (l = 0; m == 0 && l < LISTENERS; l++)
+        {
+            xmlNodePtr node = xmlNewChild (src, NULL, BAD_CAST "listener", NULL);
+            snprintf (buf, sizeof buf, "%d", l);
+            xmlSetProp (node, BAD_CAST "id", BAD_CAST buf);
+            xmlNewChild (node, NULL, BAD_CAST "IP", BAD_CAST "192.168.10.20");
+            xmlNewChild (node, NULL, BAD_CAST "UserAgent", BAD_CAST "VLC/3.0.20 LibVLC/3.0.20");
+            xmlNewChild (node, NULL, BAD_CAST "lag", BAD_CAST "1234");
+            xmlNewChild (node, NULL, BAD_CAST "Connected", BAD_CAST "3600");
+        }
+    }
+    return doc;
+}
+
+
+/* the numeric stats are known by name, as stats_get_json does */
+static void json_add_stat (json_t *json, int i)
+{
+    if (i % 3)
+        json_add_number (json, names[i], values[i]);
+    else
+        json_add_string (json, names[i], values[i]);
+}
+
+
+static char *build_json (unsigned int *len)
+{
+    json_t json;
+    int i, m, l;
+    char buf [30];
+
+    json_init (&json, 8192);
+    json_start_object (&json, NULL);
+    json_start_object (&json, "icestats");
+    for (i = 0; i < GLOBAL_STATS; i++)
+        json_add_stat (&json, i);
+    json_start_array (&json, "source");
+    for (m = 0; m < MOUNTS; m++)
+    {
+        json_start_object (&json, NULL);
+        snprintf (buf, sizeof buf, "/mount%02d.ogg", m);
+        json_add_string (&json, "mount", buf);
+        for (i = GLOBAL_STATS; i < GLOBAL_STATS + MOUNT_STATS; i++)
+            json_add_stat (&json, i);
+        if (m == 0)
+        {
+            json_start_array (&json, "listener");
+            for (l = 0; l < LISTENERS; l++)
+            {
+                json_start_object (&json, NULL);
+                json_add_int (&json, "id", l);
+                json_add_string (&json, "IP", "192.168.10.20");
+                json_add_string (&json, "UserAgent", "VLC/3.0.20 LibVLC/3.0.20");
+                json_add_int (&json, "lag", 1234);
+                json_add_int (&json, "Connected", 3600);
+                json_end_object (&json);
+            }
+            json_end_array (&json);
+        }
+        json_end_object (&json);
+    }
+    json_end_array (&json);
+    json_end_object (&json);
+    json_end_object (&json);
+    return json_finish (&json, len);
+}
+
+
+static double now (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+int main (void)
+{
+    xmlDocPtr xsl_doc = xmlReadMemory (stylesheet, strlen (stylesheet), NULL, NULL, 0);
+    xsltStylesheetPtr xsl = xsltParseStylesheetDoc (xsl_doc);
+    double start, t_xml, t_xslt, t_json;
+    unsigned int bytes_xml = 0, bytes_xslt = 0, bytes_json = 0;
+    int i;
+
+    setup ();
+    start = now ();
+    for (i = 0; i < LOOPS; i++)
+    {
+        xmlDocPtr doc = build_doc ();
+        xmlChar *buff = NULL;
+        int len = 0;
+
+        xmlDocDumpFormatMemoryEnc (doc, &buff, &len, NULL, 1);
+        bytes_xml = len;
+        xmlFree (buff);
+        xmlFreeDoc (doc);
+    }
+    t_xml = now () - start;
+
+    start = now ();
+    for (i = 0; i < LOOPS; i++)
+    {
+        xmlDocPtr doc = build_doc ();
+        xmlDocPtr res = xsltApplyStylesheet (xsl, doc, NULL);
+        xmlChar *buff = NULL;
+        int len = 0;
+
+        xsltSaveResultToString (&buff, &len, res, xsl);
+        bytes_xslt = len;
+        xmlFree (buff);
+        xmlFreeDoc (res);
+        xmlFreeDoc (doc);
+    }
+    t_xslt = now () - start;
+
+    start = now ();
+    for (i = 0; i < LOOPS; i++)
+    {
+        char *data = build_json (&bytes_json);
+        free (data);
+    }
+    t_json = now () - start;
+
+    printf ("xml dump     %8.0f docs/s  %u bytes\n", LOOPS / t_xml, bytes_xml);
+    printf ("xml + xslt   %8.0f docs/s  %u bytes\n", LOOPS / t_xslt, bytes_xslt);
+    printf ("json writer  %8.0f docs/s  %u bytes\n", LOOPS / t_json, bytes_json);
+
+    if (getenv ("SHOW"))
+    {
+        char *data = build_json (&bytes_json);
+        fwrite (data, 1, bytes_json, stdout);
+        printf ("\n");
+        free (data);
+    }
+    xsltFreeStylesheet (xsl);
+    return 0;
+}
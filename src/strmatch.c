@@ -0,0 +1,330 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* strmatch.c
+ *
+ * matching a string against a set of glob patterns in one pass. The longest
+ * literal run of each pattern is put into an Aho-Corasick automaton so a single
+ * scan of the string finds which patterns could match, only those are then
+ * checked in full. Patterns without any literal text are always checked.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_FNMATCH_H
+#include <fnmatch.h>
+#endif
+
+#include "strmatch.h"
+
+/* output states strmatch_find remembers having checked, any beyond that may
+ * have their patterns checked again */
+#define STRMATCH_SEEN           16
+
+/* largest transition table built, bigger sets are checked one at a time */
+#define STRMATCH_TABLE_MAX      (4*1024*1024)
+
+struct strmatch
+{
+    char **patterns;
+    int count, alloc;
+    int compiled;
+
+    /* automaton, next state is trans [state * classes + class [byte]] */
+    unsigned char class [256];
+    int classes;
+    int states;
+    int *trans;
+    int *out;           /* first pattern whose literal ends at this state, -1 for none */
+    int *dict;          /* nearest suffix state with output, 0 for none */
+    int *out_next;      /* per pattern, next pattern ending at the same state */
+    int *always;        /* patterns with no literal text */
+    int always_count;
+};
+
+
+strmatch *strmatch_new (void)
+{
+    return calloc (1, sizeof (strmatch));
+}
+
+
+void strmatch_free (strmatch *m)
+{
+    int i;
+
+    if (m == NULL)
+        return;
+    for (i = 0; i < m->count; i++)
+        free (m->patterns [i]);
+    free (m->patterns);
+    free (m->trans);
+    free (m->out);
+    free (m->dict);
+    free (m->out_next);
+    free (m->always);
+    free (m);
+}
+
+
+int strmatch_add (strmatch *m, const char *pattern)
+{
+    if (m->compiled)
+        return -1;
+    if (m->count == m->alloc)
+    {
+        int alloc = m->alloc ? m->alloc * 2 : 16;
+        char **p = realloc (m->patterns, alloc * sizeof (char *));
+        if (p == NULL)
+            return -1;
+        m->patterns = p;
+        m->alloc = alloc;
+    }
+    m->patterns [m->count] = strdup (pattern);
+    if (m->patterns [m->count] == NULL)
+        return -1;
+    m->count++;
+    return 0;
+}
+
+
+long strmatch_count (strmatch *m)
+{
+    return m ? m->count : 0;
+}
+
+
+/* locate the longest run of literal characters in the glob pattern */
+static const char *longest_literal (const char *pattern, int *len)
+{
+    const char *p = pattern, *best = NULL, *start = pattern;
+    int best_len = 0;
+
+    while (1)
+    {
+        if (*p == '\0' || *p == '*' || *p == '?' || *p == '[')
+        {
+            if (p - start > best_len)
+            {
+                best = start;
+                best_len = p - start;
+            }
+            if (*p == '\0')
+                break;
+            if (*p == '[')
+            {
+                /* skip the bracket expression, a ] straight after [ or [! is literal */
+                const char *q = p + 1;
+                if (*q == '!' || *q == '^') q++;
+                if (*q == ']') q++;
+                while (*q && *q != ']') q++;
+                if (*q == '\0')
+                    break;      /* unterminated, leave the rest to fnmatch */
+                p = q;
+            }
+            start = p + 1;
+        }
+        p++;
+    }
+    *len = best_len;
+    return best;
+}
+
+
+int strmatch_compile (strmatch *m)
+{
+    int i, max_states = 1, *queue = NULL, head = 0, tail = 0;
+    int *literal_len;
+    const char **literal;
+
+    if (m->compiled)
+        return 0;
+    literal = calloc (m->count + 1, sizeof (char *));
+    literal_len = calloc (m->count + 1, sizeof (int));
+    m->out_next = malloc ((m->count + 1) * sizeof (int));
+    m->always = malloc ((m->count + 1) * sizeof (int));
+    if (literal == NULL || literal_len == NULL || m->out_next == NULL || m->always == NULL)
+        goto fail;
+
+    /* bytes not in any literal share class 0 */
+    memset (m->class, 0, sizeof (m->class));
+    m->classes = 1;
+    for (i = 0; i < m->count; i++)
+    {
+        int j;
+
+        literal [i] = longest_literal (m->patterns [i], &literal_len [i]);
+        if (literal [i] == NULL)
+        {
+            m->always [m->always_count++] = i;
+            continue;
+        }
+        max_states += literal_len [i];
+        for (j = 0; j < literal_len [i]; j++)
+        {
+            unsigned char c = literal [i][j];
+            if (m->class [c] == 0)
+                m->class [c] = m->classes++;
+        }
+    }
+
+    if ((size_t)max_states * m->classes * sizeof (int) > STRMATCH_TABLE_MAX)
+        goto fail;
+    m->trans = malloc ((size_t)max_states * m->classes * sizeof (int));
+    m->out = malloc (max_states * sizeof (int));
+    m->dict = calloc (max_states, sizeof (int));
+    queue = malloc (max_states * sizeof (int));
+    if (m->trans == NULL || m->out == NULL || m->dict == NULL || queue == NULL)
+        goto fail;
+    for (i = 0; i < max_states * m->classes; i++)
+        m->trans [i] = -1;
+    for (i = 0; i < max_states; i++)
+        m->out [i] = -1;
+
+    /* trie of the literals */
+    m->states = 1;
+    for (i = 0; i < m->count; i++)
+    {
+        int j, state = 0;
+
+        if (literal [i] == NULL)
+            continue;
+        for (j = 0; j < literal_len [i]; j++)
+        {
+            int *t = &m->trans [state * m->classes + m->class [(unsigned char)literal [i][j]]];
+            if (*t < 0)
+                *t = m->states++;
+            state = *t;
+        }
+        m->out_next [i] = m->out [state];
+        m->out [state] = i;
+    }
+
+    /* breadth first over the trie, turning it into a complete automaton with the
+     * missing transitions taken from the failure state */
+    {
+        int *fail_of = calloc (m->states, sizeof (int));
+
+        if (fail_of == NULL)
+            goto fail;
+        for (i = 0; i < m->classes; i++)
+        {
+            int *t = &m->trans [i];
+            if (*t < 0)
+                *t = 0;
+            else
+            {
+                fail_of [*t] = 0;
+                queue [tail++] = *t;
+            }
+        }
+        while (head < tail)
+        {
+            int state = queue [head++], f = fail_of [state];
+
+            m->dict [state] = m->out [f] >= 0 ? f : m->dict [f];
+            for (i = 0; i < m->classes; i++)
+            {
+                int *t = &m->trans [state * m->classes + i];
+                if (*t < 0)
+                    *t = m->trans [f * m->classes + i];
+                else
+                {
+                    fail_of [*t] = m->trans [f * m->classes + i];
+                    queue [tail++] = *t;
+                }
+            }
+        }
+        free (fail_of);
+    }
+    free (queue);
+    free (literal);
+    free (literal_len);
+    m->compiled = 1;
+    return 0;
+
+fail:
+    /* left uncompiled, so patterns are checked in turn */
+    free (m->trans);
+    free (m->out);
+    free (m->dict);
+    m->trans = m->out = m->dict = NULL;
+    m->always_count = 0;
+    free (queue);
+    free (literal);
+    free (literal_len);
+    return -1;
+}
+
+
+static int pattern_match (const char *pattern, const char *value)
+{
+#ifdef HAVE_FNMATCH_H
+    return fnmatch (pattern, value, FNM_NOESCAPE) == 0;
+#else
+    return strcmp (pattern, value) == 0;
+#endif
+}
+
+
+int strmatch_find (strmatch *m, const char *value)
+{
+    const unsigned char *p = (const unsigned char *)value;
+    int i, state = 0;
+
+    if (m == NULL || m->count == 0)
+        return 0;
+    if (m->compiled == 0)
+    {
+        /* not compiled, so check each in turn */
+        for (i = 0; i < m->count; i++)
+            if (pattern_match (m->patterns [i], value))
+                return 1;
+        return 0;
+    }
+    for (i = 0; i < m->always_count; i++)
+        if (pattern_match (m->patterns [m->always [i]], value))
+            return 1;
+    if (m->states > 1)
+    {
+        /* a literal ends at just one state, so only a revisited state leads to
+         * patterns being checked again. The states after it on the suffix chain
+         * were visited along with it */
+        int seen [STRMATCH_SEEN], seen_count = 0;
+
+        for (; *p; p++)
+        {
+            int s;
+
+            state = m->trans [state * m->classes + m->class [*p]];
+            for (s = m->out [state] >= 0 ? state : m->dict [state]; s > 0; s = m->dict [s])
+            {
+                int idx, j;
+
+                for (j = 0; j < seen_count && seen [j] != s; j++)
+                    ;
+                if (j < seen_count)
+                    break;
+                if (seen_count < STRMATCH_SEEN)
+                    seen [seen_count++] = s;
+                for (idx = m->out [s]; idx >= 0; idx = m->out_next [idx])
+                    if (pattern_match (m->patterns [idx], value))
+                        return 1;
+            }
+        }
+    }
+    return 0;
+}
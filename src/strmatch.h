@@ -0,0 +1,36 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* strmatch.h
+ *
+ * matching a string against a set of glob patterns in one pass
+ *
+ */
+#ifndef __STRMATCH_H
+#define __STRMATCH_H
+
+typedef struct strmatch strmatch;
+
+strmatch *strmatch_new (void);
+void      strmatch_free (strmatch *m);
+
+/* patterns are added and then compiled once, no more can be added after.
+ * Compiling fails with -1 for a set too large to combine, the patterns are
+ * then checked one at a time */
+int       strmatch_add (strmatch *m, const char *pattern);
+int       strmatch_compile (strmatch *m);
+long      strmatch_count (strmatch *m);
+
+/* returns non-zero if any of the patterns match the whole of the value */
+int       strmatch_find (strmatch *m, const char *value);
+
+#endif /* __STRMATCH_H */
@@ -117,6 +117,19 @@ typedef mutex_t spin_t;
 #endif
 
 
+/* atomic operations on int, long or pointer sized values, these act as a full
+ * memory barrier. The value returned is the new value */
+#define thread_atomic_add(p,v)      __sync_add_and_fetch(p,v)
+#define thread_atomic_sub(p,v)      __sync_sub_and_fetch(p,v)
+#define thread_atomic_cas(p,o,n)    __sync_bool_compare_and_swap(p,o,n)
+#define thread_barrier()            __sync_synchronize()
+#ifdef __ATOMIC_SEQ_CST
+/* store new value, returning the previous */
+#define thread_atomic_swap(p,v)     __atomic_exchange_n(p,v,__ATOMIC_SEQ_CST)
+#else
+#define thread_atomic_swap(p,v)     (__sync_synchronize(), __sync_lock_test_and_set(p,v))
+#endif
+
 #define thread_create(n,x,y,z) thread_create_c(n,x,y,z,__LINE__,__FILE__)
 #define thread_mutex_create(x) thread_mutex_create_c(x,__LINE__,__FILE__)
 #define thread_mutex_destroy(x) thread_mutex_destroy_c(x,__LINE__,__FILE__)
@@ -216,7 +216,6 @@ void *xslt_update (void *arg)
 {
     xsl_req *x = arg;
     client_t *client = x->client;
-    worker_t *worker = client ? client->worker : NULL;
     char *fn = x->cache.filename;
 
     x->cache.stylesheet = xsltParseStylesheetFile (XMLSTR(fn));
@@ -249,12 +248,11 @@ void *xslt_update (void *arg)
             client_send_404 (client, "Could not parse XSLT file");
         }
         client = NULL;
-        worker = NULL;
     }
     thread_spin_lock (&update_lock);
     xsl_updating--;
     thread_spin_unlock (&update_lock);
-    if (worker) worker_wakeup (worker); // wakeup after the decrease or it may delay
+    if (client) client_wakeup (client); // wakeup after the decrease or it may delay
     if (client == NULL) free (x);
     return NULL;
 }
@@ -346,7 +344,7 @@ static int xslt_cached (const char *fn, client_t *client)
         if ((client->flags & CLIENT_ACTIVE) == 0)
         {
             client->flags |= CLIENT_ACTIVE;
-            worker_wakeup (worker);
+            client_wakeup (client);
         }
     }
     return -1;
@@ -839,7 +839,7 @@ static void *yp_update_thread(void *arg)
     /* DEBUG0("YP thread shutdown"); */
 
     ypclient.flags |= CLIENT_ACTIVE;
-    worker_wakeup (ypclient.worker);
+    client_wakeup (&ypclient);
 
     return NULL;
 }
@@ -1087,8 +1087,7 @@ void yp_stop (void)
     if (w)
     {
         ypclient.connection.error = 1;
-        ypclient.schedule_ms = 0;
-        worker_wakeup(w);
+        client_wakeup (&ypclient);
         DEBUG0 ("YP client is now stopped");
     }
 }